@@ -1,28 +1,268 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "ast.h"
 
+THREAD_LOCAL ast_store_t ast_tree = NULL;
+static THREAD_LOCAL list_queue_t _funcs = {NULL, NULL};
+/* How many expressions, variables and held positions the store had when
+ * it was set. */
+static THREAD_LOCAL int _mark_exprs, _mark_vars, _mark_held;
+
+ast_store_t ast_store_new(void)
+{
+    ast_store_t p = checked_malloc(sizeof(*p));
+    memset(p, 0, sizeof(*p));
+    p->expr_count = p->var_count = 1;
+    p->arena = arena_new();
+    return p;
+}
+
+#define FREE_PAGES(column, cap) \
+    do \
+    { \
+        int page_; \
+        for (page_ = 0; page_ < (cap) >> AST_PAGE_BITS; page_++) \
+            free((column)[page_]); \
+        free(column); \
+    } \
+    while (false)
+
+static void free_columns(ast_store_t store)
+{
+    FREE_PAGES(store->kinds, store->expr_cap);
+    FREE_PAGES(store->positions, store->expr_cap);
+    FREE_PAGES(store->payloads, store->expr_cap);
+    FREE_PAGES(store->var_kinds, store->var_cap);
+    FREE_PAGES(store->var_positions, store->var_cap);
+    FREE_PAGES(store->var_bases, store->var_cap);
+    FREE_PAGES(store->var_args, store->var_cap);
+    FREE_PAGES(store->calls, store->caps[AST_CALL_EXPR]);
+    FREE_PAGES(store->ops, store->caps[AST_OP_EXPR]);
+    FREE_PAGES(store->records, store->caps[AST_RECORD_EXPR]);
+    FREE_PAGES(store->arrays, store->caps[AST_ARRAY_EXPR]);
+    FREE_PAGES(store->seqs, store->caps[AST_SEQ_EXPR]);
+    FREE_PAGES(store->ifs, store->caps[AST_IF_EXPR]);
+    FREE_PAGES(store->whiles, store->caps[AST_WHILE_EXPR]);
+    FREE_PAGES(store->fors, store->caps[AST_FOR_EXPR]);
+    FREE_PAGES(store->lets, store->caps[AST_LET_EXPR]);
+    FREE_PAGES(store->assigns, store->caps[AST_ASSIGN_EXPR]);
+    FREE_PAGES(store->strings, store->caps[AST_STRING_EXPR]);
+    FREE_PAGES(store->kids, store->kid_cap);
+    free(store->held);
+}
+
+void ast_store_free(ast_store_t store)
+{
+    free_columns(store);
+    arena_free(store->arena);
+    free(store);
+}
+
+void ast_store_reset(ast_store_t store)
+{
+    arena_t arena = store->arena;
+
+    free_columns(store);
+    memset(store, 0, sizeof(*store));
+    store->expr_count = store->var_count = 1;
+    store->arena = arena;
+    arena_reset(arena);
+}
+
+arena_t ast_store_arena(ast_store_t store)
+{
+    return store->arena;
+}
+
+void ast_set_store(ast_store_t store)
+{
+    ast_tree = store;
+    _funcs.head = _funcs.tail = NULL;
+    if (store)
+    {
+        _mark_exprs = store->expr_count;
+        _mark_vars = store->var_count;
+        _mark_held = store->held_count;
+    }
+}
+
+ast_store_t ast_get_store(void)
+{
+    return ast_tree;
+}
+
+static void *ast_alloc(int size)
+{
+    assert(ast_tree);
+    return arena_alloc(ast_tree->arena, size);
+}
+
+/* A node takes only the room its own variant needs rather than that of the
+ * largest member of its union, so the small and common ones pack
+ * densely. */
+#define NODE_SIZE(type, member) \
+    (offsetof(struct type, u) + sizeof(((struct type *) 0)->u.member))
+
+static void *resize(void *p, size_t size)
+{
+    p = realloc(p, size);
+    assert(p);
+    return p;
+}
+
+/* Add page, a new last one, to column. */
+#define ADD_PAGE(column, page) \
+    do \
+    { \
+        (column) = resize((column), ((page) + 1) * sizeof(*(column))); \
+        (column)[page] = checked_malloc(AST_PAGE_SIZE * sizeof(**(column))); \
+    } \
+    while (false)
+
+static void hold(int *pos)
+{
+    ast_store_t t = ast_tree;
+
+    if (t->held_count == t->held_cap)
+        t->held = grow_array(t->held, t->held_count, &t->held_cap,
+                             sizeof(*t->held));
+    t->held[t->held_count++] = pos;
+}
+
+static ast_expr_t new_expr(ast_expr_kind_t kind, int pos, uint32_t payload)
+{
+    ast_store_t t = ast_tree;
+
+    assert(t);
+    if (t->expr_count >= t->expr_cap)
+    {
+        int page = t->expr_cap >> AST_PAGE_BITS;
+
+        ADD_PAGE(t->kinds, page);
+        ADD_PAGE(t->positions, page);
+        ADD_PAGE(t->payloads, page);
+        t->expr_cap += AST_PAGE_SIZE;
+    }
+    AST_AT(t->kinds, t->expr_count) = kind;
+    AST_AT(t->positions, t->expr_count) = pos;
+    AST_AT(t->payloads, t->expr_count) = payload;
+    return t->expr_count++;
+}
+
+/* The index of a new payload of kind. */
+static uint32_t new_payload(ast_expr_kind_t kind)
+{
+    ast_store_t t = ast_tree;
+
+    assert(t);
+    if (t->counts[kind] == t->caps[kind])
+    {
+        int page = t->caps[kind] >> AST_PAGE_BITS;
+
+        switch (kind)
+        {
+            case AST_STRING_EXPR: ADD_PAGE(t->strings, page); break;
+            case AST_CALL_EXPR: ADD_PAGE(t->calls, page); break;
+            case AST_OP_EXPR: ADD_PAGE(t->ops, page); break;
+            case AST_RECORD_EXPR: ADD_PAGE(t->records, page); break;
+            case AST_ARRAY_EXPR: ADD_PAGE(t->arrays, page); break;
+            case AST_SEQ_EXPR: ADD_PAGE(t->seqs, page); break;
+            case AST_IF_EXPR: ADD_PAGE(t->ifs, page); break;
+            case AST_WHILE_EXPR: ADD_PAGE(t->whiles, page); break;
+            case AST_FOR_EXPR: ADD_PAGE(t->fors, page); break;
+            case AST_LET_EXPR: ADD_PAGE(t->lets, page); break;
+            case AST_ASSIGN_EXPR: ADD_PAGE(t->assigns, page); break;
+            default: assert(0);
+        }
+        t->caps[kind] += AST_PAGE_SIZE;
+    }
+    return t->counts[kind]++;
+}
+
+/* Copy the expressions of list into the kids column. */
+static uint32_t add_kids(list_t list, int *count)
+{
+    ast_store_t t = ast_tree;
+    uint32_t first = t->kid_count;
+
+    for (*count = 0; list; list = list->next, ++*count)
+    {
+        if (t->kid_count == t->kid_cap)
+        {
+            ADD_PAGE(t->kids, t->kid_cap >> AST_PAGE_BITS);
+            t->kid_cap += AST_PAGE_SIZE;
+        }
+        AST_AT(t->kids, t->kid_count) = (ast_expr_t) (uintptr_t) list->data;
+        t->kid_count++;
+    }
+    return first;
+}
+
+static ast_var_t new_var(ast_var_kind_t kind, int pos, ast_var_t base,
+                         union ast_var_arg_u arg)
+{
+    ast_store_t t = ast_tree;
+
+    assert(t);
+    if (t->var_count >= t->var_cap)
+    {
+        int page = t->var_cap >> AST_PAGE_BITS;
+
+        ADD_PAGE(t->var_kinds, page);
+        ADD_PAGE(t->var_positions, page);
+        ADD_PAGE(t->var_bases, page);
+        ADD_PAGE(t->var_args, page);
+        t->var_cap += AST_PAGE_SIZE;
+    }
+    AST_AT(t->var_kinds, t->var_count) = kind;
+    AST_AT(t->var_positions, t->var_count) = pos;
+    AST_AT(t->var_bases, t->var_count) = base;
+    AST_AT(t->var_args, t->var_count) = arg;
+    return t->var_count++;
+}
+
+list_t ast_list(void *data, list_t next)
+{
+    list_t p = ast_alloc(sizeof(*p));
+    p->data = data;
+    p->next = next;
+    return p;
+}
+
+string_t ast_string(const char *str, int len)
+{
+    assert(ast_tree);
+    return arena_string(ast_tree->arena, str, len);
+}
+
 ast_decl_t ast_funcs_decl(int pos, list_t funcs)
 {
-    ast_decl_t p = checked_malloc(sizeof(*p));
+    ast_decl_t p = ast_alloc(NODE_SIZE(ast_decl_s, funcs));
     p->kind = AST_FUNCS_DECL;
     p->pos = pos;
+    hold(&p->pos);
     p->u.funcs = funcs;
     return p;
 }
 
 ast_decl_t ast_types_decl(int pos, list_t types)
 {
-    ast_decl_t p = checked_malloc(sizeof(*p));
+    ast_decl_t p = ast_alloc(NODE_SIZE(ast_decl_s, types));
     p->kind = AST_TYPES_DECL;
     p->pos = pos;
+    hold(&p->pos);
     p->u.types = types;
     return p;
 }
 
 ast_decl_t ast_var_decl(int pos, symbol_t var, symbol_t type, ast_expr_t init)
 {
-    ast_decl_t p = checked_malloc(sizeof(*p));
+    ast_decl_t p = ast_alloc(NODE_SIZE(ast_decl_s, var));
     p->kind = AST_VAR_DECL;
     p->pos = pos;
+    hold(&p->pos);
     p->u.var.var = var;
     p->u.var.type = type;
     p->u.var.init = init;
@@ -32,212 +272,187 @@ ast_decl_t ast_var_decl(int pos, symbol_t var, symbol_t type, ast_expr_t init)
 
 ast_expr_t ast_nil_expr(int pos)
 {
-    ast_expr_t p = checked_malloc(sizeof(*p));
-    p->kind = AST_NIL_EXPR;
-    p->pos = pos;
-    return p;
+    return new_expr(AST_NIL_EXPR, pos, 0);
 }
 
 ast_expr_t ast_var_expr(int pos, ast_var_t var)
 {
-    ast_expr_t p = checked_malloc(sizeof(*p));
-    p->kind = AST_VAR_EXPR;
-    p->pos = pos;
-    p->u.var = var;
-    return p;
+    return new_expr(AST_VAR_EXPR, pos, var);
 }
 
 ast_expr_t ast_num_expr(int pos, int num)
 {
-    ast_expr_t p = checked_malloc(sizeof(*p));
-    p->kind = AST_NUM_EXPR;
-    p->pos = pos;
-    p->u.num = num;
-    return p;
+    return new_expr(AST_NUM_EXPR, pos, (uint32_t) num);
 }
 
 ast_expr_t ast_string_expr(int pos, string_t str)
 {
-    ast_expr_t p = checked_malloc(sizeof(*p));
-    p->kind = AST_STRING_EXPR;
-    p->pos = pos;
-    p->u.str = str;
-    return p;
+    uint32_t i = new_payload(AST_STRING_EXPR);
+    AST_AT(ast_tree->strings, i) = str;
+    return new_expr(AST_STRING_EXPR, pos, i);
 }
 
 ast_expr_t ast_call_expr(int pos, symbol_t func, list_t args)
 {
-    ast_expr_t p = checked_malloc(sizeof(*p));
-    p->kind = AST_CALL_EXPR;
-    p->pos = pos;
-    p->u.call.func = func;
-    p->u.call.args = args;
-    return p;
+    uint32_t i = new_payload(AST_CALL_EXPR);
+    struct ast_call_s *p = &AST_AT(ast_tree->calls, i);
+    p->func = func;
+    p->first = add_kids(args, &p->count);
+    return new_expr(AST_CALL_EXPR, pos, i);
 }
 
 ast_expr_t ast_op_expr(int pos, ast_expr_t left, ast_binop_t op, ast_expr_t right)
 {
-    ast_expr_t p = checked_malloc(sizeof(*p));
-    p->kind = AST_OP_EXPR;
-    p->pos = pos;
-    p->u.op.left = left;
-    p->u.op.op = op;
-    p->u.op.right = right;
-    return p;
+    uint32_t i = new_payload(AST_OP_EXPR);
+    struct ast_op_s *p = &AST_AT(ast_tree->ops, i);
+    p->left = left;
+    p->op = op;
+    p->right = right;
+    return new_expr(AST_OP_EXPR, pos, i);
 }
 
 ast_expr_t ast_record_expr(int pos, symbol_t type, list_t efields)
 {
-    ast_expr_t p = checked_malloc(sizeof(*p));
-    p->kind = AST_RECORD_EXPR;
-    p->pos = pos;
-    p->u.record.type = type;
-    p->u.record.efields = efields;
-    return p;
+    uint32_t i = new_payload(AST_RECORD_EXPR);
+    struct ast_record_s *p = &AST_AT(ast_tree->records, i);
+    p->type = type;
+    p->efields = efields;
+    return new_expr(AST_RECORD_EXPR, pos, i);
 }
 
 ast_expr_t ast_array_expr(int pos, symbol_t type, ast_expr_t size, ast_expr_t init)
 {
-    ast_expr_t p = checked_malloc(sizeof(*p));
-    p->kind = AST_ARRAY_EXPR;
-    p->pos = pos;
-    p->u.array.type = type;
-    p->u.array.size = size;
-    p->u.array.init = init;
-    return p;
+    uint32_t i = new_payload(AST_ARRAY_EXPR);
+    struct ast_array_s *p = &AST_AT(ast_tree->arrays, i);
+    p->type = type;
+    p->size = size;
+    p->init = init;
+    return new_expr(AST_ARRAY_EXPR, pos, i);
 }
 
 ast_expr_t ast_seq_expr(int pos, list_t seq)
 {
-    ast_expr_t p = checked_malloc(sizeof(*p));
-    p->kind = AST_SEQ_EXPR;
-    p->pos = pos;
-    p->u.seq = seq;
-    return p;
+    uint32_t i = new_payload(AST_SEQ_EXPR);
+    struct ast_seq_s *p = &AST_AT(ast_tree->seqs, i);
+    p->first = add_kids(seq, &p->count);
+    return new_expr(AST_SEQ_EXPR, pos, i);
 }
 
 ast_expr_t ast_if_expr(int pos, ast_expr_t cond, ast_expr_t then, ast_expr_t else_)
 {
-    ast_expr_t p = checked_malloc(sizeof(*p));
-    p->kind = AST_IF_EXPR;
-    p->pos = pos;
-    p->u.if_.cond = cond;
-    p->u.if_.then = then;
-    p->u.if_.else_ = else_;
-    return p;
+    uint32_t i = new_payload(AST_IF_EXPR);
+    struct ast_if_s *p = &AST_AT(ast_tree->ifs, i);
+    p->cond = cond;
+    p->then = then;
+    p->else_ = else_;
+    return new_expr(AST_IF_EXPR, pos, i);
 }
 
 ast_expr_t ast_while_expr(int pos, ast_expr_t cond, ast_expr_t body)
 {
-    ast_expr_t p = checked_malloc(sizeof(*p));
-    p->kind = AST_WHILE_EXPR;
-    p->pos = pos;
-    p->u.while_.cond = cond;
-    p->u.while_.body = body;
-    return p;
+    uint32_t i = new_payload(AST_WHILE_EXPR);
+    struct ast_while_s *p = &AST_AT(ast_tree->whiles, i);
+    p->cond = cond;
+    p->body = body;
+    return new_expr(AST_WHILE_EXPR, pos, i);
 }
 
 ast_expr_t ast_for_expr(int pos, symbol_t var, ast_expr_t lo, ast_expr_t hi, ast_expr_t body)
 {
-    ast_expr_t p = checked_malloc(sizeof(*p));
-    p->kind = AST_FOR_EXPR;
-    p->pos = pos;
-    p->u.for_.var = var;
-    p->u.for_.lo = lo;
-    p->u.for_.hi = hi;
-    p->u.for_.body = body;
-    p->u.for_.escape = false;
-    return p;
+    uint32_t i = new_payload(AST_FOR_EXPR);
+    struct ast_for_s *p = &AST_AT(ast_tree->fors, i);
+    p->var = var;
+    p->lo = lo;
+    p->hi = hi;
+    p->body = body;
+    p->escape = false;
+    return new_expr(AST_FOR_EXPR, pos, i);
 }
 
 ast_expr_t ast_break_expr(int pos)
 {
-    ast_expr_t p = checked_malloc(sizeof(*p));
-    p->kind = AST_BREAK_EXPR;
-    p->pos = pos;
-    return p;
+    return new_expr(AST_BREAK_EXPR, pos, 0);
 }
 
 ast_expr_t ast_let_expr(int pos, list_t decls, ast_expr_t body)
 {
-    ast_expr_t p = checked_malloc(sizeof(*p));
-    p->kind = AST_LET_EXPR;
-    p->pos = pos;
-    p->u.let.decls = decls;
-    p->u.let.body = body;
-    return p;
+    uint32_t i = new_payload(AST_LET_EXPR);
+    struct ast_let_s *p = &AST_AT(ast_tree->lets, i);
+    p->decls = decls;
+    p->body = body;
+    return new_expr(AST_LET_EXPR, pos, i);
 }
 
 ast_expr_t ast_assign_expr(int pos, ast_var_t var, ast_expr_t expr)
 {
-    ast_expr_t p = checked_malloc(sizeof(*p));
-    p->kind = AST_ASSIGN_EXPR;
-    p->pos = pos;
-    p->u.assign.var = var;
-    p->u.assign.expr = expr;
-    return p;
+    uint32_t i = new_payload(AST_ASSIGN_EXPR);
+    struct ast_assign_s *p = &AST_AT(ast_tree->assigns, i);
+    p->var = var;
+    p->expr = expr;
+    return new_expr(AST_ASSIGN_EXPR, pos, i);
 }
 
 ast_type_t ast_name_type(int pos, symbol_t name)
 {
-    ast_type_t p = checked_malloc(sizeof(*p));
+    ast_type_t p = ast_alloc(NODE_SIZE(ast_type_s, name));
     p->kind = AST_NAME_TYPE;
     p->pos = pos;
+    hold(&p->pos);
     p->u.name = name;
     return p;
 }
 
 ast_type_t ast_record_type(int pos, list_t record)
 {
-    ast_type_t p = checked_malloc(sizeof(*p));
+    ast_type_t p = ast_alloc(NODE_SIZE(ast_type_s, record));
     p->kind = AST_RECORD_TYPE;
     p->pos = pos;
+    hold(&p->pos);
     p->u.record = record;
     return p;
 }
 
 ast_type_t ast_array_type(int pos, symbol_t array)
 {
-    ast_type_t p = checked_malloc(sizeof(*p));
+    ast_type_t p = ast_alloc(NODE_SIZE(ast_type_s, array));
     p->kind = AST_ARRAY_TYPE;
     p->pos = pos;
+    hold(&p->pos);
     p->u.array = array;
     return p;
 }
 
 ast_var_t ast_simple_var(int pos, symbol_t simple)
 {
-    ast_var_t p = checked_malloc(sizeof(*p));
-    p->kind = AST_SIMPLE_VAR;
-    p->pos = pos;
-    p->u.simple = simple;
-    return p;
+    union ast_var_arg_u arg;
+    arg.name = simple;
+    return new_var(AST_SIMPLE_VAR, pos, 0, arg);
 }
 
 ast_var_t ast_field_var(int pos, ast_var_t var, symbol_t field)
 {
-    ast_var_t p = checked_malloc(sizeof(*p));
-    p->kind = AST_FIELD_VAR;
-    p->pos = pos;
-    p->u.field.var = var;
-    p->u.field.field = field;
-    return p;
+    union ast_var_arg_u arg;
+    arg.name = field;
+    return new_var(AST_FIELD_VAR, pos, var, arg);
 }
 
 ast_var_t ast_sub_var(int pos, ast_var_t var, ast_expr_t sub)
 {
-    ast_var_t p = checked_malloc(sizeof(*p));
-    p->kind = AST_SUB_VAR;
-    p->pos = pos;
-    p->u.sub.var = var;
-    p->u.sub.sub = sub;
-    return p;
+    union ast_var_arg_u arg;
+    arg.sub = sub;
+    return new_var(AST_SUB_VAR, pos, var, arg);
+}
+
+void ast_set_var_base(ast_var_t var, ast_var_t base)
+{
+    AST_AT(ast_tree->var_bases, var) = base;
 }
 
 ast_efield_t ast_efield(int pos, symbol_t name, ast_expr_t expr)
 {
-    ast_efield_t p = checked_malloc(sizeof(*p));
+    ast_efield_t p = ast_alloc(sizeof(*p));
     p->pos = pos;
+    hold(&p->pos);
     p->name = name;
     p->expr = expr;
     return p;
@@ -245,7 +460,7 @@ ast_efield_t ast_efield(int pos, symbol_t name, ast_expr_t expr)
 
 ast_field_t ast_field(symbol_t name, symbol_t type)
 {
-    ast_field_t p = checked_malloc(sizeof(*p));
+    ast_field_t p = ast_alloc(sizeof(*p));
     p->name = name;
     p->type = type;
     p->escape = false;
@@ -254,19 +469,63 @@ ast_field_t ast_field(symbol_t name, symbol_t type)
 
 ast_func_t ast_func(int pos, symbol_t name, list_t params, symbol_t result, ast_expr_t body)
 {
-    ast_func_t p = checked_malloc(sizeof(*p));
+    ast_func_t p = ast_alloc(sizeof(*p));
     p->pos = pos;
     p->name = name;
     p->params = params;
     p->result = result;
     p->body = body;
+    p->body_start = p->body_end = 0;
+    hold(&p->pos);
+    hold(&p->body_start);
+    hold(&p->body_end);
+    p->checked = false;
+    p->diags = NULL;
+    p->lifted = false;
+    p->free = NULL;
+    list_enqueue(&_funcs, ast_list(p, NULL));
     return p;
 }
 
+list_t ast_funcs(void)
+{
+    return _funcs.head;
+}
+
 ast_nametype_t ast_nametype(symbol_t name, ast_type_t type)
 {
-    ast_nametype_t p = checked_malloc(sizeof(*p));
+    ast_nametype_t p = ast_alloc(sizeof(*p));
     p->name = name;
     p->type = type;
     return p;
 }
+
+ast_diag_t ast_diag(int pos, string_t msg)
+{
+    ast_diag_t p = ast_alloc(sizeof(*p));
+    p->pos = pos;
+    p->msg = msg;
+    return p;
+}
+
+/* Shifting runs down the position columns and the positions held in the
+ * other nodes rather than walking the tree.  Nodes the tree no longer
+ * reaches move too, which does no harm. */
+static void shift_pos(int *pos, int from, int delta)
+{
+    if (*pos >= from)
+        *pos += delta;
+}
+
+void ast_shift(int from, int delta)
+{
+    ast_store_t t = ast_tree;
+    int i;
+
+    for (i = 1; i < _mark_exprs; i++)
+        shift_pos(&AST_AT(t->positions, i), from, delta);
+    for (i = 1; i < _mark_vars; i++)
+        shift_pos(&AST_AT(t->var_positions, i), from, delta);
+    for (i = 0; i < _mark_held; i++)
+        shift_pos(t->held[i], from, delta);
+}
@@ -1,18 +1,47 @@
 #ifndef INCLUDE__AST_H
 #define INCLUDE__AST_H
 
+#include <stdint.h>
+
 #include "symbol.h"
 #include "utils.h"
 
 typedef struct ast_decl_s *ast_decl_t;
-typedef struct ast_expr_s *ast_expr_t;
+typedef uint32_t ast_expr_t;
 typedef struct ast_type_s *ast_type_t;
-typedef struct ast_var_s *ast_var_t;
+typedef uint32_t ast_var_t;
 
 typedef struct ast_efield_s *ast_efield_t;
 typedef struct ast_field_s *ast_field_t;
 typedef struct ast_func_s *ast_func_t;
 typedef struct ast_nametype_s *ast_nametype_t;
+typedef struct ast_diag_s *ast_diag_t;
+
+/* Expressions and variables are numbered from 1 in the order they are
+ * made, 0 standing for none, and kept in a store as columns: their kinds,
+ * positions and payloads each in an array of their own, and the payloads
+ * of each kind in one more.  A walk then reads the few bytes of each node
+ * it needs from arrays it runs through mostly in order.  The other nodes,
+ * the list cells and the strings of the tree are carved out of the
+ * store's arena and live exactly as long as it does. */
+typedef struct ast_store_s *ast_store_t;
+ast_store_t ast_store_new(void);
+void ast_store_free(ast_store_t store);
+/* Forget every node, as arena_reset does. */
+void ast_store_reset(ast_store_t store);
+arena_t ast_store_arena(ast_store_t store);
+/* Nodes are made in and read from the store set here for the thread. */
+void ast_set_store(ast_store_t store);
+ast_store_t ast_get_store(void);
+list_t ast_list(void *data, list_t next);
+string_t ast_string(const char *str, int len);
+/* The functions made since the store was set, nested ones before those
+ * they are nested in. */
+list_t ast_funcs(void);
+/* Move every position at or after from by delta, as after text was
+ * inserted or removed there, in the nodes made before the store was
+ * last set. */
+void ast_shift(int from, int delta);
 
 typedef enum ast_binop_e ast_binop_t;
 enum ast_binop_e
@@ -36,39 +65,36 @@ ast_decl_t ast_funcs_decl(int pos, list_t funcs);
 ast_decl_t ast_types_decl(int pos, list_t types);
 ast_decl_t ast_var_decl(int pos, symbol_t var, symbol_t type, ast_expr_t init);
 
-struct ast_expr_s
+typedef enum ast_expr_kind_e ast_expr_kind_t;
+enum ast_expr_kind_e
 {
-    enum
-    {
-        AST_NIL_EXPR, AST_VAR_EXPR, AST_NUM_EXPR, AST_STRING_EXPR,
-        AST_CALL_EXPR, AST_OP_EXPR, AST_RECORD_EXPR, AST_ARRAY_EXPR,
-        AST_SEQ_EXPR, AST_IF_EXPR, AST_WHILE_EXPR, AST_FOR_EXPR,
-        AST_BREAK_EXPR, AST_LET_EXPR, AST_ASSIGN_EXPR,
-    } kind;
-    int pos;
-    union
-    {
-        /* nil; */
-        ast_var_t var;
-        int num;
-        string_t str;
-        struct { symbol_t func; list_t args; } call;
-        struct { ast_expr_t left; ast_binop_t op; ast_expr_t right; } op;
-        struct { symbol_t type; list_t efields; } record;
-        struct { symbol_t type; ast_expr_t size, init; } array;
-        list_t seq;
-        struct { ast_expr_t cond, then, else_; } if_;
-        struct { ast_expr_t cond, body; } while_;
-        struct { symbol_t var; ast_expr_t lo, hi, body; bool escape; } for_;
-        /* break; */
-        struct { list_t decls; ast_expr_t body; } let;
-        struct { ast_var_t var; ast_expr_t expr; } assign;
-    } u;
+    AST_NIL_EXPR, AST_VAR_EXPR, AST_NUM_EXPR, AST_STRING_EXPR,
+    AST_CALL_EXPR, AST_OP_EXPR, AST_RECORD_EXPR, AST_ARRAY_EXPR,
+    AST_SEQ_EXPR, AST_IF_EXPR, AST_WHILE_EXPR, AST_FOR_EXPR,
+    AST_BREAK_EXPR, AST_LET_EXPR, AST_ASSIGN_EXPR,
 };
+
+/* The payloads of the kinds that need more than a word.  The arguments of
+ * a call and the expressions of a sequence are the count entries from
+ * first on in a column of their own. */
+struct ast_call_s { symbol_t func; uint32_t first; int count; };
+struct ast_op_s { ast_expr_t left; ast_binop_t op; ast_expr_t right; };
+struct ast_record_s { symbol_t type; list_t efields; };
+struct ast_array_s { symbol_t type; ast_expr_t size, init; };
+struct ast_seq_s { uint32_t first; int count; };
+struct ast_if_s { ast_expr_t cond, then, else_; };
+struct ast_while_s { ast_expr_t cond, body; };
+struct ast_for_s { symbol_t var; ast_expr_t lo, hi, body; bool escape; };
+struct ast_let_s { list_t decls; ast_expr_t body; };
+struct ast_assign_s { ast_var_t var; ast_expr_t expr; };
+
 ast_expr_t ast_nil_expr(int pos);
 ast_expr_t ast_var_expr(int pos, ast_var_t var);
 ast_expr_t ast_num_expr(int pos, int num);
 ast_expr_t ast_string_expr(int pos, string_t str);
+/* args and seq are lists of expressions, each held in its cell's data as
+ * AST_EXPR_DATA puts it there. */
+#define AST_EXPR_DATA(expr) ((void *) (uintptr_t) (expr))
 ast_expr_t ast_call_expr(int pos, symbol_t func, list_t args);
 ast_expr_t ast_op_expr(int pos, ast_expr_t left, ast_binop_t op, ast_expr_t right);
 ast_expr_t ast_record_expr(int pos, symbol_t type, list_t efields);
@@ -96,29 +122,176 @@ ast_type_t ast_name_type(int pos, symbol_t name);
 ast_type_t ast_record_type(int pos, list_t record);
 ast_type_t ast_array_type(int pos, symbol_t array);
 
-struct ast_var_s
-{
-    enum { AST_SIMPLE_VAR, AST_FIELD_VAR, AST_SUB_VAR } kind;
-    int pos;
-    union
-    {
-        symbol_t simple;
-        /* var must be the first field to simplify the parser implementation. */
-        struct { ast_var_t var; symbol_t field; } field;
-        struct { ast_var_t var; ast_expr_t sub; } sub;
-    } u;
-};
+typedef enum ast_var_kind_e ast_var_kind_t;
+enum ast_var_kind_e { AST_SIMPLE_VAR, AST_FIELD_VAR, AST_SUB_VAR };
+
 ast_var_t ast_simple_var(int pos, symbol_t simple);
 ast_var_t ast_field_var(int pos, ast_var_t var, symbol_t field);
 ast_var_t ast_sub_var(int pos, ast_var_t var, ast_expr_t sub);
+/* The parser makes a field or subscript before the variable it applies
+ * to, and fills that in later. */
+void ast_set_var_base(ast_var_t var, ast_var_t base);
 
 struct ast_efield_s { int pos; symbol_t name; ast_expr_t expr; };
 ast_efield_t ast_efield(int pos, symbol_t name, ast_expr_t expr);
 struct ast_field_s { symbol_t name, type; bool escape; };
 ast_field_t ast_field(symbol_t name, symbol_t type);
-struct ast_func_s { int pos; symbol_t name; list_t params; symbol_t result; ast_expr_t body; };
+struct ast_func_s
+{
+    int pos;
+    symbol_t name;
+    list_t params;
+    symbol_t result;
+    ast_expr_t body;
+    /* The body's text runs from body_start up to the token after it.  Once
+     * checked, diags holds what checking the body reported, so that it
+     * can be reported again while the body and its surroundings stay as
+     * they are. */
+    int body_start, body_end;
+    bool checked;
+    list_t diags;
+    /* Set by lift_funcs: a lifted function has no static link, and the
+     * variables of enclosing functions it uses come after its parameters,
+     * as the fields in free. */
+    bool lifted;
+    list_t free;
+};
 ast_func_t ast_func(int pos, symbol_t name, list_t params, symbol_t result, ast_expr_t body);
 struct ast_nametype_s { symbol_t name; ast_type_t type; };
 ast_nametype_t ast_nametype(symbol_t name, ast_type_t type);
+/* pos is relative to the function's. */
+struct ast_diag_s { int pos; string_t msg; };
+ast_diag_t ast_diag(int pos, string_t msg);
+
+/* The columns, each kept in pages of AST_PAGE_SIZE entries that never
+ * move once made, so that a column grows without copying what it holds.
+ * Each expression's payload is its index among those of its kind, or
+ * else its number, its string's index or its variable.  A variable's base
+ * is the one it takes a field or subscript of, and its argument the name,
+ * field or subscript. */
+#define AST_PAGE_BITS 12
+#define AST_PAGE_SIZE (1 << AST_PAGE_BITS)
+#define AST_AT(column, i) \
+    ((column)[(i) >> AST_PAGE_BITS][(i) & (AST_PAGE_SIZE - 1)])
+
+union ast_var_arg_u
+{
+    symbol_t name;
+    ast_expr_t sub;
+};
+
+/* Each count is of the entries in use, and each cap of those the pages
+ * hold. */
+struct ast_store_s
+{
+    unsigned char **kinds;
+    int **positions;
+    uint32_t **payloads;
+    int expr_count, expr_cap;
+
+    unsigned char **var_kinds;
+    int **var_positions;
+    ast_var_t **var_bases;
+    union ast_var_arg_u **var_args;
+    int var_count, var_cap;
+
+    struct ast_call_s **calls;
+    struct ast_op_s **ops;
+    struct ast_record_s **records;
+    struct ast_array_s **arrays;
+    struct ast_seq_s **seqs;
+    struct ast_if_s **ifs;
+    struct ast_while_s **whiles;
+    struct ast_for_s **fors;
+    struct ast_let_s **lets;
+    struct ast_assign_s **assigns;
+    string_t **strings;
+    int counts[AST_ASSIGN_EXPR + 1], caps[AST_ASSIGN_EXPR + 1];
+    ast_expr_t **kids;
+    int kid_count, kid_cap;
+
+    /* The positions held in the other nodes, for ast_shift. */
+    int **held;
+    int held_count, held_cap;
+    arena_t arena;
+};
+
+/* The store set for the thread. */
+extern THREAD_LOCAL ast_store_t ast_tree;
+
+static inline ast_expr_kind_t ast_kind(ast_expr_t expr)
+{
+    return AST_AT(ast_tree->kinds, expr);
+}
+
+static inline int ast_pos(ast_expr_t expr)
+{
+    return AST_AT(ast_tree->positions, expr);
+}
+
+static inline int ast_num(ast_expr_t expr)
+{
+    return (int) AST_AT(ast_tree->payloads, expr);
+}
+
+static inline string_t ast_str(ast_expr_t expr)
+{
+    return AST_AT(ast_tree->strings, AST_AT(ast_tree->payloads, expr));
+}
+
+static inline ast_var_t ast_var(ast_expr_t expr)
+{
+    return AST_AT(ast_tree->payloads, expr);
+}
+
+#define AST_PAYLOAD(name, column) \
+    static inline struct ast_##name##_s *ast_##name(ast_expr_t expr) \
+    { \
+        return &AST_AT(ast_tree->column, AST_AT(ast_tree->payloads, expr)); \
+    }
+AST_PAYLOAD(call, calls)
+AST_PAYLOAD(op, ops)
+AST_PAYLOAD(record, records)
+AST_PAYLOAD(array, arrays)
+AST_PAYLOAD(seq, seqs)
+AST_PAYLOAD(if, ifs)
+AST_PAYLOAD(while, whiles)
+AST_PAYLOAD(for, fors)
+AST_PAYLOAD(let, lets)
+AST_PAYLOAD(assign, assigns)
+#undef AST_PAYLOAD
+
+/* The i-th of the arguments of a call or the expressions of a sequence
+ * whose first is first. */
+static inline ast_expr_t ast_kid(uint32_t first, int i)
+{
+    return AST_AT(ast_tree->kids, first + i);
+}
+
+static inline ast_var_kind_t ast_var_kind(ast_var_t var)
+{
+    return AST_AT(ast_tree->var_kinds, var);
+}
+
+static inline int ast_var_pos(ast_var_t var)
+{
+    return AST_AT(ast_tree->var_positions, var);
+}
+
+static inline ast_var_t ast_var_base(ast_var_t var)
+{
+    return AST_AT(ast_tree->var_bases, var);
+}
+
+/* A simple variable's name, or the field a field variable takes. */
+static inline symbol_t ast_var_name(ast_var_t var)
+{
+    return AST_AT(ast_tree->var_args, var).name;
+}
+
+static inline ast_expr_t ast_var_sub(ast_var_t var)
+{
+    return AST_AT(ast_tree->var_args, var).sub;
+}
 
 #endif
@@ -0,0 +1,20 @@
+#!/bin/sh
+# Measure how batch compilation scales with the number of jobs.
+#
+# Usage: bench/batch.sh path/to/tiger [files] [functions-per-file]
+
+TIGER=${1:?usage: $0 path/to/tiger [files] [functions-per-file]}
+FILES=${2:-64}
+N=${3:-500}
+DIR=$(mktemp -d /tmp/tiger-batch.XXXXXX)
+trap 'rm -rf "$DIR"' EXIT
+
+i=0
+while [ $i -lt "$FILES" ]; do
+    "$(dirname "$0")"/gen.sh funcs "$N" > "$DIR/unit$i.tig"
+    i=$((i + 1))
+done
+
+for jobs in 1 2 4 8 16; do
+    "$TIGER" --stats -j $jobs "$DIR"/*.tig 2>&1 >/dev/null | grep '^batch:'
+done
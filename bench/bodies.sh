@@ -0,0 +1,23 @@
+#!/bin/sh
+# Time checking and translating one big declaration group with its bodies
+# on one thread and on several, and check that the output is the same.
+#
+# Usage: bench/bodies.sh path/to/tiger [functions] [threads]
+
+TIGER=${1:?usage: $0 path/to/tiger [functions] [threads]}
+N=${2:-50000}
+JOBS=${3:-4}
+DIR=$(mktemp -d /tmp/tiger-bodies.XXXXXX)
+trap 'rm -rf "$DIR"' EXIT
+
+"$(dirname "$0")"/gen.sh funcs "$N" > "$DIR/funcs.tig"
+
+for jobs in 1 "$JOBS"; do
+    echo "--body-jobs $jobs:"
+    "$TIGER" --body-jobs "$jobs" --check-only --stats "$DIR/funcs.tig" \
+        2>&1 >/dev/null | grep '^check'
+    "$TIGER" --body-jobs "$jobs" --stats "$DIR/funcs.tig" \
+        2>"$DIR/stats" >"$DIR/out$jobs"
+    grep '^semantic' "$DIR/stats"
+done
+cmp -s "$DIR/out1" "$DIR/out$JOBS" && echo "same output" || echo "OUTPUT DIFFERS"
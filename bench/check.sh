@@ -0,0 +1,31 @@
+#!/bin/sh
+# Compare type-checking alone with the full pipeline on a batch of
+# generated programs.
+#
+# Usage: bench/check.sh path/to/tiger [files] [functions-per-file]
+
+TIGER=${1:?usage: $0 path/to/tiger [files] [functions-per-file]}
+FILES=${2:-64}
+N=${3:-500}
+DIR=$(mktemp -d /tmp/tiger-check.XXXXXX)
+trap 'rm -rf "$DIR"' EXIT
+
+i=0
+while [ $i -lt "$FILES" ]; do
+    "$(dirname "$0")"/gen.sh funcs "$N" > "$DIR/funcs$i.tig"
+    "$(dirname "$0")"/gen.sh lets "$N" > "$DIR/lets$i.tig"
+    i=$((i + 1))
+done
+
+# Sum each phase over the files, then show the whole batch.
+for flag in "" --check-only; do
+    echo "${flag:-full pipeline}:"
+    "$TIGER" $flag --stats -j 1 "$DIR"/*.tig 2>&1 >/dev/null | awk '
+        /^batch:/ { batch = $0; next }
+        { t[$1] += $2 }
+        END {
+            for (p in t)
+                printf "    %-10s %8.3fs\n", p, t[p]
+            print "    " batch
+        }'
+done
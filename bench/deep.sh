@@ -0,0 +1,20 @@
+#!/bin/sh
+# Compile programs nested 100000 levels deep in each of the shapes gen.sh
+# knows, parsing only and then through the semantic phase.  None of them
+# should need more than the default stack.
+#
+# Usage: bench/deep.sh path/to/tiger [depth]
+
+TIGER=${1:?usage: $0 path/to/tiger [depth]}
+N=${2:-100000}
+SRC=$(mktemp /tmp/tiger-deep.XXXXXX)
+trap 'rm -f "$SRC"' EXIT
+
+for kind in chain parens nest elifs vars; do
+    "$(dirname "$0")"/gen.sh $kind $N > "$SRC"
+    echo "$kind, $N deep:"
+    "$TIGER" --parse-only --stats "$SRC" 2>&1 >/dev/null | sed 's/^/    /'
+    # Subscripts are not translated yet, so vars is only checked.
+    if [ $kind = vars ]; then phase=--check-only; else phase=--no-output; fi
+    "$TIGER" $phase --stats "$SRC" 2>&1 >/dev/null | sed 's/^/    /'
+done
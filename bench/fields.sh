@@ -0,0 +1,17 @@
+#!/bin/sh
+# Time checking field accesses as records grow wider.  Each program reads
+# every field of one record once, so the time per field should stay flat.
+#
+# Usage: bench/fields.sh path/to/tiger [widths...]
+
+TIGER=${1:?usage: $0 path/to/tiger [widths...]}
+shift
+DIR=$(mktemp -d /tmp/tiger-fields.XXXXXX)
+trap 'rm -rf "$DIR"' EXIT
+
+for n in ${@:-1000 4000 16000}; do
+    "$(dirname "$0")"/gen.sh fields "$n" > "$DIR/fields$n.tig"
+    printf "%6d fields: " "$n"
+    "$TIGER" --check-only --stats "$DIR/fields$n.tig" 2>&1 >/dev/null \
+        | grep '^check'
+done
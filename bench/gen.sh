@@ -0,0 +1,146 @@
+#!/bin/sh
+# Generate large Tiger programs for the benchmarks in this directory.
+#
+# Usage: bench/gen.sh funcs N    N small functions in one declaration group
+#        bench/gen.sh lets N     N variable declarations in one let, both in
+#                                a function and at the top level
+#        bench/gen.sh chain N    an expression of N additions, nested to the
+#                                left as the grammar associates them
+#        bench/gen.sh parens N   N additions nested to the right in parens
+#        bench/gen.sh nest N     N lets, each in the body of the last
+#        bench/gen.sh elifs N    an else-if chain N conditionals deep
+#        bench/gen.sh fields N   a record type of N fields, built and read
+#                                field by field
+#        bench/gen.sh types N    N mutually recursive types in one group,
+#                                records and aliases by turns
+#        bench/gen.sh vars N     an assignment to an element N arrays deep,
+#                                and a field access N records deep
+
+KIND=${1:?usage: $0 kind n}
+N=${2:?usage: $0 kind n}
+
+case "$KIND" in
+funcs)
+    awk -v n="$N" 'BEGIN {
+        print "let"
+        print "  type point = {x: int, y: int}"
+        for (i = 0; i < n; i++) {
+            printf "  function f%d(a: int, b: int): int =\n", i
+            printf "    let var p := point {x = a, y = b * %d}\n", i
+            printf "        var s := \"f%d\"\n", i
+            printf "    in if p.x > p.y then p.x - 1 else f%d(p.y, a + 1) end\n", (i + 1) % n
+        }
+        print "in"
+        print "  f0(1, 2)"
+        print "end"
+    }'
+    ;;
+lets)
+    awk -v n="$N" 'BEGIN {
+        print "let"
+        print "  function f(a: int): int ="
+        print "    let"
+        for (i = 0; i < n; i++)
+            printf "      var l%d := a + %d\n", i, i
+        print "    in l0 end"
+        for (i = 0; i < n; i++)
+            printf "  var v%d := \"v%d\"\n", i, i
+        print "in"
+        print "  f(1)"
+        print "end"
+    }'
+    ;;
+chain)
+    awk -v n="$N" 'BEGIN {
+        printf "1"
+        for (i = 0; i < n; i++)
+            printf " + 1%s", i % 16 == 15 ? "\n" : ""
+        print ""
+    }'
+    ;;
+parens)
+    awk -v n="$N" 'BEGIN {
+        for (i = 0; i < n; i++)
+            printf "1 + (%s", i % 16 == 15 ? "\n" : ""
+        printf "1"
+        for (i = 0; i < n; i++)
+            printf ")%s", i % 64 == 63 ? "\n" : ""
+        print ""
+    }'
+    ;;
+nest)
+    awk -v n="$N" 'BEGIN {
+        print "let var x0 := 0 in"
+        for (i = 1; i < n; i++)
+            printf "let var x%d := x%d + 1 in\n", i, i - 1
+        printf "x%d\n", n - 1
+        for (i = 0; i < n; i++)
+            printf "end%s", i % 16 == 15 ? "\n" : " "
+        print ""
+    }'
+    ;;
+elifs)
+    awk -v n="$N" 'BEGIN {
+        print "let var a := 7 in"
+        for (i = 0; i < n; i++)
+            printf "if a = %d then %d else\n", i, i
+        print "-1"
+        print "end"
+    }'
+    ;;
+fields)
+    awk -v n="$N" 'BEGIN {
+        print "let"
+        printf "  type rec = {"
+        for (i = 0; i < n; i++)
+            printf "%sf%d: int", i ? ", " : "", i
+        print "}"
+        printf "  var r := rec {"
+        for (i = 0; i < n; i++)
+            printf "%sf%d = %d%s", i ? ", " : "", i, i, i % 8 == 7 ? "\n" : ""
+        print "}"
+        print "  var s := 0"
+        print "in"
+        for (i = 0; i < n; i++)
+            printf "  s := s + r.f%d;\n", n - 1 - i
+        print "  s"
+        print "end"
+    }'
+    ;;
+types)
+    awk -v n="$N" 'BEGIN {
+        print "let"
+        for (i = 0; i < n; i++)
+            if (i % 2)
+                printf "  type t%d = t%d\n", i, (i + 1) % n
+            else
+                printf "  type t%d = {v: int, next: t%d}\n", i, (i + 1) % n
+        print "  var r := t0 {v = 1, next = nil}"
+        print "in"
+        print "  r.v"
+        print "end"
+    }'
+    ;;
+vars)
+    awk -v n="$N" 'BEGIN {
+        print "let"
+        print "  type node = {v: int, n: node}"
+        print "  type cube = array of cube"
+        print "  var r := node {v = 1, n = nil}"
+        printf "  function f(c: cube) =\n    c"
+        for (i = 0; i < n; i++)
+            printf "[0]%s", i % 32 == 31 ? "\n" : ""
+        print " := c"
+        print "in"
+        printf "  r"
+        for (i = 0; i < n; i++)
+            printf ".n%s", i % 32 == 31 ? "\n" : ""
+        print ".v"
+        print "end"
+    }'
+    ;;
+*)
+    echo "$0: unknown kind '$KIND'" >&2
+    exit 1
+    ;;
+esac
@@ -0,0 +1,20 @@
+#!/bin/sh
+# Time checking ever larger declaration groups of functions and of types.
+# The time per declaration should stay flat as the groups grow.
+#
+# Usage: bench/groups.sh path/to/tiger [sizes...]
+
+TIGER=${1:?usage: $0 path/to/tiger [sizes...]}
+shift
+DIR=$(mktemp -d /tmp/tiger-groups.XXXXXX)
+trap 'rm -rf "$DIR"' EXIT
+
+for kind in funcs types; do
+    echo "$kind:"
+    for n in ${@:-1000 2000 4000 8000 16000}; do
+        "$(dirname "$0")"/gen.sh "$kind" "$n" > "$DIR/$kind$n.tig"
+        printf "%8d: " "$n"
+        "$TIGER" --check-only --stats "$DIR/$kind$n.tig" 2>&1 >/dev/null \
+            | grep '^check'
+    done
+done
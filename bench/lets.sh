@@ -0,0 +1,15 @@
+#!/bin/sh
+# Show how compile time grows with the number of declarations in a let;
+# it should roughly double with each row.
+#
+# Usage: bench/lets.sh path/to/tiger
+
+TIGER=${1:?usage: $0 path/to/tiger}
+SRC=$(mktemp /tmp/tiger-lets.XXXXXX)
+trap 'rm -f "$SRC"' EXIT
+
+for n in 4000 8000 16000 32000 64000; do
+    "$(dirname "$0")"/gen.sh lets $n > "$SRC"
+    echo "$n declarations:"
+    "$TIGER" --stats "$SRC" 2>&1 >/dev/null | sed 's/^/    /'
+done
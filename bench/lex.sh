@@ -0,0 +1,19 @@
+#!/bin/sh
+# Compare scanner throughput of the mmap and stdio input paths.
+#
+# Usage: bench/lex.sh path/to/tiger [megabytes]
+
+TIGER=${1:?usage: $0 path/to/tiger [megabytes]}
+MB=${2:-32}
+DIR=$(dirname "$0")/..
+SRC=$(mktemp /tmp/tiger-lex.XXXXXX)
+trap 'rm -f "$SRC"' EXIT
+
+while [ $(wc -c < "$SRC") -lt $((MB * 1024 * 1024)) ]; do
+    cat "$DIR"/tests/*.tig "$DIR"/tests/*.tig "$DIR"/tests/*.tig >> "$SRC"
+done
+
+for i in 1 2 3; do
+    "$TIGER" --lex-only "$SRC"
+    "$TIGER" --lex-only --no-mmap "$SRC"
+done
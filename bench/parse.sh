@@ -0,0 +1,14 @@
+#!/bin/sh
+# Report parse time and peak RSS on a large generated program.
+#
+# Usage: bench/parse.sh path/to/tiger [functions]
+
+TIGER=${1:?usage: $0 path/to/tiger [functions]}
+N=${2:-20000}
+SRC=$(mktemp /tmp/tiger-parse.XXXXXX)
+trap 'rm -f "$SRC"' EXIT
+
+"$(dirname "$0")"/gen.sh funcs "$N" > "$SRC"
+for i in 1 2 3; do
+    "$TIGER" --parse-only --stats "$SRC"
+done
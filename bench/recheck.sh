@@ -0,0 +1,42 @@
+#!/bin/sh
+# Measure how long the check-only server takes to answer after a one-line
+# edit to a single function body of a large unit, against a full check.
+#
+# Usage: bench/recheck.sh path/to/tiger [functions] [edits]
+
+TIGER=${1:?usage: $0 path/to/tiger [functions] [edits]}
+N=${2:-12500}
+EDITS=${3:-20}
+DIR=$(mktemp -d /tmp/tiger-recheck.XXXXXX)
+SOCK=$DIR/sock
+trap 'kill $SERVER 2>/dev/null; rm -rf "$DIR"' EXIT
+
+"$(dirname "$0")"/gen.sh funcs "$N" > "$DIR/v0.tig"
+
+# Each version edits one more function body than the one before it.
+i=1
+while [ $i -le "$EDITS" ]; do
+    k=$(( (i * 7919) % N ))
+    sed "s/y = b \* $k}/y = b * $k + $i}/" "$DIR/v$((i - 1)).tig" \
+        > "$DIR/v$i.tig"
+    i=$((i + 1))
+done
+
+echo "full check:"
+"$TIGER" --check-only --stats "$DIR/v0.tig" 2>&1 >/dev/null | grep check
+
+"$TIGER" --serve "$SOCK" --check-only -j 1 &
+SERVER=$!
+while [ ! -S "$SOCK" ]; do sleep 0.1; done
+
+echo "first request:"
+"$TIGER" --connect "$SOCK" --stats "$DIR/v0.tig" 2>&1 >/dev/null \
+    | grep '^serve:'
+
+echo "edits:"
+i=1
+while [ $i -le "$EDITS" ]; do
+    echo "$DIR/v$i.tig"
+    i=$((i + 1))
+done | xargs "$TIGER" --connect "$SOCK" --stats 2>&1 >/dev/null \
+    | grep '^serve:'
@@ -0,0 +1,44 @@
+#!/bin/sh
+# Compare per-request latency of the compile server with running the
+# compiler once per file.
+#
+# Usage: bench/serve.sh path/to/tiger [files] [functions-per-file]
+
+TIGER=${1:?usage: $0 path/to/tiger [files] [functions-per-file]}
+FILES=${2:-200}
+N=${3:-20}
+DIR=$(mktemp -d /tmp/tiger-serve.XXXXXX)
+SOCK=$DIR/sock
+trap 'kill $SERVER 2>/dev/null; rm -rf "$DIR"' EXIT
+
+i=0
+while [ $i -lt "$FILES" ]; do
+    "$(dirname "$0")"/gen.sh funcs "$N" > "$DIR/unit$i.tig"
+    i=$((i + 1))
+done
+
+# Print p50 and p99 of the nanosecond times read from stdin.
+percentiles() {
+    sort -n | awk -v what="$1" '{ t[NR] = $1 }
+        END { printf "%-8s %d requests, p50 %.3fms, p99 %.3fms\n", what, NR,
+                     t[int((NR + 1) / 2)] / 1e6, t[int((NR * 99 + 99) / 100)] / 1e6 }'
+}
+
+for f in "$DIR"/*.tig; do
+    start=$(date +%s%N)
+    "$TIGER" "$f" >/dev/null 2>&1
+    echo $(($(date +%s%N) - start))
+done | percentiles fork:
+
+"$TIGER" --serve "$SOCK" &
+SERVER=$!
+while [ ! -S "$SOCK" ]; do sleep 0.1; done
+
+for f in "$DIR"/*.tig; do
+    start=$(date +%s%N)
+    "$TIGER" --connect "$SOCK" "$f" >/dev/null 2>&1
+    echo $(($(date +%s%N) - start))
+done | percentiles client:
+
+# Latency of the requests alone, without starting a client per file.
+"$TIGER" --connect "$SOCK" --stats "$DIR"/*.tig 2>&1 >/dev/null | grep '^serve:'
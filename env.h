@@ -25,6 +25,8 @@ struct env_entry_s
             tmp_label_t label;
             list_t formals;
             type_t result;
+            /* A lifted function's free variables, as fields. */
+            list_t free;
         } func;
     } u;
 };
@@ -32,9 +34,10 @@ env_entry_t env_var_entry(tr_access_t access, type_t type, bool for_);
 env_entry_t env_func_entry(tr_level_t level,
                            tmp_label_t label,
                            list_t formals,
-                           type_t result);
+                           type_t result,
+                           list_t free);
 
-table_t env_base_tenv(void);
-table_t env_base_venv(void);
+sym_table_t env_base_tenv(void);
+sym_table_t env_base_venv(void);
 
 #endif
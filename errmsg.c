@@ -1,56 +1,216 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 
 #include "errmsg.h"
 
-bool em_any_errors = false;
-int em_tok_pos = 0;
+THREAD_LOCAL bool em_any_errors = false;
+THREAD_LOCAL int em_tok_pos = 0;
+bool em_lazy_lines = true;
 
-extern FILE *yyin;
+static THREAD_LOCAL string_t _filename = "";
+static THREAD_LOCAL FILE *_out = NULL;
+static THREAD_LOCAL em_handler_t _handler = NULL;
+static THREAD_LOCAL void *_handler_data = NULL;
 
-static string_t _filename = "";
-static int _line_num = 1;
-static list_t _line_pos = NULL;
+static THREAD_LOCAL bool _log = false;
+static THREAD_LOCAL em_diag_t *_diags = NULL;
+static THREAD_LOCAL int _diag_count = 0;
+static THREAD_LOCAL int _diag_cap = 0;
+
+/* Positions of the newlines in the source, ascending, after a sentinel 0
+ * for the start of the first line. */
+static THREAD_LOCAL int *_lines = NULL;
+static THREAD_LOCAL int _line_count = 0;
+static THREAD_LOCAL int _line_cap = 0;
+
+/* In lazy mode the scanner's newlines are ignored and the index is built
+ * from the source itself when the first diagnostic needs it.  The source
+ * is the file, unless a buffer is being compiled. */
+static THREAD_LOCAL bool _lazy = false;
+static THREAD_LOCAL bool _indexed = false;
+static THREAD_LOCAL const char *_source = NULL;
+static THREAD_LOCAL int _source_len = 0;
+
+static void add_line(int pos)
+{
+    if (_line_count == _line_cap)
+    {
+        int *p;
+
+        _line_cap = _line_cap ? _line_cap * 2 : 1024;
+        p = checked_malloc(_line_cap * sizeof(*p));
+        if (_lines)
+        {
+            memcpy(p, _lines, _line_count * sizeof(*p));
+            free(_lines);
+        }
+        _lines = p;
+    }
+    _lines[_line_count++] = pos;
+}
+
+static void index_lines(void)
+{
+    FILE *fp;
+    int ch, pos = 1;
+
+    _indexed = true;
+    if (_source)
+    {
+        for (; pos <= _source_len; pos++)
+            if (_source[pos - 1] == '\n')
+                add_line(pos);
+        return;
+    }
+    fp = fopen(_filename, "r");
+    if (!fp)
+        return;
+    while ((ch = getc(fp)) != EOF)
+    {
+        if (ch == '\n')
+            add_line(pos);
+        pos++;
+    }
+    fclose(fp);
+}
 
 void em_newline(void)
 {
-    ++_line_num;
-    _line_pos = int_list(em_tok_pos, _line_pos);
+    if (!_lazy)
+        add_line(em_tok_pos);
+}
+
+/* The log takes msg over. */
+static void add_diag(int pos, string_t msg)
+{
+    if (_diag_count == _diag_cap)
+    {
+        em_diag_t *diags;
+
+        _diag_cap = _diag_cap ? _diag_cap * 2 : 16;
+        diags = checked_malloc(_diag_cap * sizeof(*diags));
+        if (_diags)
+        {
+            memcpy(diags, _diags, _diag_count * sizeof(*diags));
+            free(_diags);
+        }
+        _diags = diags;
+    }
+    _diags[_diag_count].pos = pos;
+    _diags[_diag_count].msg = msg;
+    _diag_count++;
 }
 
 void em_error(int pos, string_t msg, ...)
 {
-    va_list ap;
-    list_t lines = _line_pos;
-    int line = _line_num;
+    va_list ap, copy;
+    FILE *out = _out ? _out : stderr;
+    string_t text;
+    int lo = 0, hi, col, len;
 
     em_any_errors = true;
-    while (lines && lines->i >= pos)
+    if (_lazy && !_indexed)
+        index_lines();
+
+    /* Count the line starts before pos. */
+    hi = _line_count;
+    while (lo < hi)
     {
-        lines = lines->next;
-        --line;
+        int mid = lo + (hi - lo) / 2;
+        if (_lines[mid] < pos)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
 
-    if (_filename)
-        fprintf(stderr, "%s:", _filename);
-    fprintf(stderr, "%d.%d: ", line, lines ? pos - lines->i : pos);
+    col = lo ? pos - _lines[lo - 1] : pos;
+
     va_start(ap, msg);
-    vfprintf(stderr, msg, ap);
+    if (!_log && !_handler)
+    {
+        if (_filename)
+            fprintf(out, "%s:", _filename);
+        fprintf(out, "%d.%d: ", lo, col);
+        vfprintf(out, msg, ap);
+        fprintf(out, "\n");
+        va_end(ap);
+        return;
+    }
+
+    /* Whoever keeps or handles the message gets all of it. */
+    va_copy(copy, ap);
+    len = vsnprintf(NULL, 0, msg, copy);
+    va_end(copy);
+    text = checked_malloc(len + 1);
+    vsnprintf(text, len + 1, msg, ap);
     va_end(ap);
-    fprintf(stderr, "\n");
+
+    if (_handler)
+        _handler(_handler_data, lo, col, text);
+    else
+    {
+        if (_filename)
+            fprintf(out, "%s:", _filename);
+        fprintf(out, "%d.%d: %s\n", lo, col, text);
+    }
+    if (_log)
+        add_diag(pos, text);
+    else
+        free(text);
 }
 
-void em_reset(string_t filename)
+const em_diag_t *em_diags(int *count)
+{
+    *count = _diag_count;
+    return _diags;
+}
+
+void em_set_log(bool log)
 {
+    _log = log;
+}
+
+void em_set_output(FILE *out)
+{
+    _out = out;
+}
+
+void em_set_handler(em_handler_t handler, void *data)
+{
+    _handler = handler;
+    _handler_data = data;
+}
+
+static void reset(string_t filename, const char *source, int len)
+{
+    int i;
+
+    for (i = 0; i < _diag_count; i++)
+        free(_diags[i].msg);
+    _diag_count = 0;
     em_any_errors = false;
     _filename = filename;
-    _line_num = 1;
-    _line_pos = int_list(0, NULL);
-    yyin = fopen(_filename, "r");
-    if (!yyin)
-    {
-        em_error(0, "cannot open file: %s", _filename);
-        exit(1);
-    }
+    _source = source;
+    _source_len = len;
+    _line_count = 0;
+    add_line(0);
+    _indexed = false;
+}
+
+void em_reset(string_t filename)
+{
+    struct stat st;
+
+    reset(filename, NULL, 0);
+    /* Only a regular file can be read a second time. */
+    _lazy = em_lazy_lines && stat(filename, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+void em_reset_buffer(string_t name, const char *buf, int len)
+{
+    reset(name, buf, len);
+    _lazy = em_lazy_lines;
 }
@@ -1,14 +1,41 @@
 #ifndef INCLUDE__ERRMSG_H
 #define INCLUDE__ERRMSG_H
 
+#include <stdio.h>
+
 #include "utils.h"
 
-extern bool em_any_errors;
-extern int em_tok_pos;
+extern THREAD_LOCAL bool em_any_errors;
+extern THREAD_LOCAL int em_tok_pos;
+/* Index line starts only once a diagnostic is reported; on by default. */
+extern bool em_lazy_lines;
 
 void em_newline(void);
 void em_error(int pos, string_t msg, ...);
 /* void em_impossible(string_t, ...); */
 void em_reset(string_t file);
+/* Like em_reset, for source held in memory.  The buffer must outlive the
+ * unit's diagnostics. */
+void em_reset_buffer(string_t name, const char *buf, int len);
+/* Send this thread's diagnostics to out; NULL means stderr. */
+void em_set_output(FILE *out);
+
+/* Hand this thread's diagnostics to handler instead of printing them;
+ * NULL restores printing. */
+typedef void (*em_handler_t)(void *data, int line, int column, string_t msg);
+void em_set_handler(em_handler_t handler, void *data);
+
+/* Keep this thread's diagnostics for em_diags as they are reported; off
+ * until asked for, as only cached checks and pooled bodies read them. */
+void em_set_log(bool log);
+
+/* Every diagnostic logged since the last reset, oldest first. */
+typedef struct em_diag_s em_diag_t;
+struct em_diag_s
+{
+    int pos;
+    string_t msg;
+};
+const em_diag_t *em_diags(int *count);
 
 #endif
@@ -11,167 +11,274 @@ struct escape_entry_s
 static escape_entry_t escape_entry(int depth, bool *escape)
 {
     assert(escape);
-    escape_entry_t p = checked_malloc(sizeof(*p));
+    escape_entry_t p = unit_alloc(sizeof(*p));
     p->depth = depth;
     p->escape = escape;
     *escape = false;
     return p;
 }
 
-static int _depth;
-static table_t _env;
+static THREAD_LOCAL int _depth;
+static THREAD_LOCAL sym_table_t _env;
 
-static void traverse_decl(ast_decl_t decl);
-static void traverse_expr(ast_expr_t expr);
-static void traverse_var(ast_var_t var);
+static void esc_reset(void)
+{
+    _depth = 0;
+    if (_env)
+        sym_free(_env);
+    _env = sym_empty();
+}
 
-static void traverse_decl(ast_decl_t decl)
+static void esc_begin_scope(void)
 {
-    switch (decl->kind)
-    {
-        case AST_FUNCS_DECL: {
-            list_t p = decl->u.funcs;
-            for (; p; p = p->next)
-            {
-                ast_func_t func = p->data;
-                list_t q;
-
-                _depth++;
-                sym_begin_scope(_env);
-                for (q = func->params; q; q = q->next)
-                {
-                    ast_field_t field = q->data;
-                    sym_enter(_env,
-                              field->name,
-                              escape_entry(_depth, &field->escape));
-                }
-                traverse_expr(func->body);
-                sym_end_scope(_env);
-                _depth--;
-            }
-            break;
-        }
+    sym_begin_scope(_env);
+}
 
-        case AST_TYPES_DECL:
-            break;
+static void esc_end_scope(void)
+{
+    sym_end_scope(_env);
+}
 
-        case AST_VAR_DECL:
-            sym_enter(_env,
-                      decl->u.var.var,
-                      escape_entry(_depth, &decl->u.var.escape));
-            traverse_expr(decl->u.var.init);
-            break;
+static void esc_begin_func(list_t params)
+{
+    _depth++;
+    sym_begin_scope(_env);
+    for (; params; params = params->next)
+    {
+        ast_field_t field = params->data;
+        sym_enter(_env, field->name, escape_entry(_depth, &field->escape));
     }
 }
 
-static void traverse_expr(ast_expr_t expr)
+static void esc_end_func(void)
+{
+    sym_end_scope(_env);
+    _depth--;
+}
+
+static void esc_declare(symbol_t var, bool *escape)
+{
+    sym_enter(_env, var, escape_entry(_depth, escape));
+}
+
+static void esc_use(symbol_t var)
 {
-    list_t p;
+    escape_entry_t entry = sym_lookup(_env, var);
+    if (entry && entry->depth < _depth)
+        *entry->escape = true;
+}
 
-    switch (expr->kind)
+/* The walk keeps what is left to do on a stack of its own rather than
+ * recursing, so that it needs no more of the thread's stack however deep
+ * the program nests.  Each step is one of these, and those that stand for
+ * the rest of a list take it one element at a time. */
+typedef struct escape_step_s escape_step_t;
+struct escape_step_s
+{
+    enum
     {
-        case AST_NIL_EXPR:
-            break;
+        ESC_EXPR, ESC_DECLS, ESC_FUNCS, ESC_EFIELDS, ESC_BEGIN_SCOPE,
+        ESC_END_SCOPE, ESC_END_FUNC, ESC_DECLARE,
+    } kind;
+    union
+    {
+        ast_expr_t expr;
+        list_t list;
+        struct { symbol_t var; bool *escape; } declare;
+    } u;
+};
 
-        case AST_VAR_EXPR:
-            traverse_var(expr->u.var);
-            break;
+static THREAD_LOCAL escape_step_t *_steps;
+static THREAD_LOCAL int _step_count, _step_cap;
+
+static escape_step_t *push(int kind)
+{
+    if (_step_count == _step_cap)
+        _steps = grow_array(_steps, _step_count, &_step_cap, sizeof(*_steps));
+    _steps[_step_count].kind = kind;
+    return &_steps[_step_count++];
+}
+
+static void push_expr(ast_expr_t expr)
+{
+    push(ESC_EXPR)->u.expr = expr;
+}
+
+static void push_list(int kind, list_t list)
+{
+    if (list)
+        push(kind)->u.list = list;
+}
 
+static void push_declare(symbol_t var, bool *escape)
+{
+    escape_step_t *step = push(ESC_DECLARE);
+    step->u.declare.var = var;
+    step->u.declare.escape = escape;
+}
+
+/* The variable at the bottom of var is used first, then the subscripts
+ * are walked from the innermost out; the steps pushed here run before
+ * any pushed earlier. */
+static void walk_var(ast_var_t var)
+{
+    for (; ast_var_kind(var) != AST_SIMPLE_VAR; var = ast_var_base(var))
+        if (ast_var_kind(var) == AST_SUB_VAR)
+            push_expr(ast_var_sub(var));
+    esc_use(ast_var_name(var));
+}
+
+/* Push the steps for expr, the last to run first. */
+static void visit_expr(ast_expr_t expr)
+{
+    int i;
+
+    switch (ast_kind(expr))
+    {
+        case AST_NIL_EXPR:
         case AST_NUM_EXPR:
         case AST_STRING_EXPR:
+        case AST_BREAK_EXPR:
+            break;
+
+        case AST_VAR_EXPR:
+            walk_var(ast_var(expr));
             break;
 
         case AST_CALL_EXPR:
-            for (p = expr->u.call.args; p; p = p->next)
-                traverse_expr(p->data);
+            for (i = ast_call(expr)->count - 1; i >= 0; i--)
+                push_expr(ast_kid(ast_call(expr)->first, i));
             break;
 
         case AST_OP_EXPR:
-            traverse_expr(expr->u.op.left);
-            traverse_expr(expr->u.op.right);
+            push_expr(ast_op(expr)->right);
+            push_expr(ast_op(expr)->left);
             break;
 
         case AST_RECORD_EXPR:
-            for (p = expr->u.record.efields; p; p = p->next)
-                traverse_expr(((ast_efield_t) p->data)->expr);
+            push_list(ESC_EFIELDS, ast_record(expr)->efields);
             break;
 
         case AST_ARRAY_EXPR:
-            traverse_expr(expr->u.array.size);
-            traverse_expr(expr->u.array.init);
+            push_expr(ast_array(expr)->init);
+            push_expr(ast_array(expr)->size);
             break;
 
         case AST_SEQ_EXPR:
-            for (p = expr->u.seq; p; p = p->next)
-                traverse_expr(p->data);
+            for (i = ast_seq(expr)->count - 1; i >= 0; i--)
+                push_expr(ast_kid(ast_seq(expr)->first, i));
             break;
 
         case AST_IF_EXPR:
-            traverse_expr(expr->u.if_.cond);
-            traverse_expr(expr->u.if_.then);
-            if (expr->u.if_.else_)
-                traverse_expr(expr->u.if_.else_);
+            if (ast_if(expr)->else_)
+                push_expr(ast_if(expr)->else_);
+            push_expr(ast_if(expr)->then);
+            push_expr(ast_if(expr)->cond);
             break;
 
         case AST_WHILE_EXPR:
-            traverse_expr(expr->u.while_.cond);
-            traverse_expr(expr->u.while_.body);
+            push_expr(ast_while(expr)->body);
+            push_expr(ast_while(expr)->cond);
             break;
 
         case AST_FOR_EXPR:
-            traverse_expr(expr->u.for_.lo);
-            traverse_expr(expr->u.for_.hi);
-            sym_begin_scope(_env);
-            sym_enter(_env,
-                      expr->u.for_.var,
-                      escape_entry(_depth, &expr->u.for_.escape));
-            traverse_expr(expr->u.for_.body);
-            sym_end_scope(_env);
-            break;
-
-        case AST_BREAK_EXPR:
+            push(ESC_END_SCOPE);
+            push_expr(ast_for(expr)->body);
+            push_declare(ast_for(expr)->var, &ast_for(expr)->escape);
+            push(ESC_BEGIN_SCOPE);
+            push_expr(ast_for(expr)->hi);
+            push_expr(ast_for(expr)->lo);
             break;
 
         case AST_LET_EXPR:
-            sym_begin_scope(_env);
-            for (p = expr->u.let.decls; p; p = p->next)
-                traverse_decl(p->data);
-            traverse_expr(expr->u.let.body);
-            sym_end_scope(_env);
+            esc_begin_scope();
+            push(ESC_END_SCOPE);
+            push_expr(ast_let(expr)->body);
+            push_list(ESC_DECLS, ast_let(expr)->decls);
             break;
 
         case AST_ASSIGN_EXPR:
-            traverse_var(expr->u.assign.var);
-            traverse_expr(expr->u.assign.expr);
+            push_expr(ast_assign(expr)->expr);
+            walk_var(ast_assign(expr)->var);
             break;
     }
 }
 
-static void traverse_var(ast_var_t var)
+static void visit_decl(ast_decl_t decl)
 {
-    switch (var->kind)
+    switch (decl->kind)
     {
-        case AST_SIMPLE_VAR: {
-            escape_entry_t entry = sym_lookup(_env, var->u.simple);
-            if (entry && entry->depth < _depth)
-                *entry->escape = true;
+        case AST_FUNCS_DECL:
+            push_list(ESC_FUNCS, decl->u.funcs);
             break;
-        }
 
-        case AST_FIELD_VAR:
-            traverse_var(var->u.field.var);
+        case AST_TYPES_DECL:
             break;
 
-        case AST_SUB_VAR:
-            traverse_var(var->u.sub.var);
-            traverse_expr(var->u.sub.sub);
+        case AST_VAR_DECL:
+            /* The variable is not in scope in its own initializer. */
+            push_declare(decl->u.var.var, &decl->u.var.escape);
+            push_expr(decl->u.var.init);
             break;
     }
 }
 
+static void traverse_expr(ast_expr_t expr)
+{
+    int base = _step_count;
+
+    push_expr(expr);
+    while (_step_count > base)
+    {
+        escape_step_t step = _steps[--_step_count];
+
+        switch (step.kind)
+        {
+            case ESC_EXPR:
+                visit_expr(step.u.expr);
+                break;
+
+            case ESC_DECLS:
+                push_list(ESC_DECLS, step.u.list->next);
+                visit_decl(step.u.list->data);
+                break;
+
+            case ESC_FUNCS: {
+                ast_func_t func = step.u.list->data;
+
+                push_list(ESC_FUNCS, step.u.list->next);
+                esc_begin_func(func->params);
+                push(ESC_END_FUNC);
+                push_expr(func->body);
+                break;
+            }
+
+            case ESC_EFIELDS:
+                push_list(ESC_EFIELDS, step.u.list->next);
+                push_expr(((ast_efield_t) step.u.list->data)->expr);
+                break;
+
+            case ESC_BEGIN_SCOPE:
+                esc_begin_scope();
+                break;
+
+            case ESC_END_SCOPE:
+                esc_end_scope();
+                break;
+
+            case ESC_END_FUNC:
+                esc_end_func();
+                break;
+
+            case ESC_DECLARE:
+                esc_declare(step.u.declare.var, step.u.declare.escape);
+                break;
+        }
+    }
+}
+
 void esc_find_escape(ast_expr_t expr)
 {
-    _depth = 0;
-    _env = sym_empty();
+    esc_reset();
     traverse_expr(expr);
 }
@@ -7,7 +7,7 @@ struct frame_s
 {
     tmp_label_t name;
     list_t formals;
-    list_t locals;
+    list_queue_t locals;
     int local_count;
 };
 
@@ -23,7 +23,7 @@ struct fr_access_s
 
 static fr_access_t in_frame(int offset)
 {
-    fr_access_t p = checked_malloc(sizeof(*p));
+    fr_access_t p = unit_alloc(sizeof(*p));
     p->kind = FR_IN_FRAME;
     p->u.offset = offset;
     return p;
@@ -31,7 +31,7 @@ static fr_access_t in_frame(int offset)
 
 static fr_access_t in_reg(temp_t reg)
 {
-    fr_access_t p = checked_malloc(sizeof(*p));
+    fr_access_t p = unit_alloc(sizeof(*p));
     p->kind = FR_IN_REG;
     p->u.reg = reg;
     return p;
@@ -39,12 +39,13 @@ static fr_access_t in_reg(temp_t reg)
 
 frame_t frame(tmp_label_t name, list_t formals)
 {
-    frame_t p = checked_malloc(sizeof(*p));
+    frame_t p = unit_alloc(sizeof(*p));
     list_t formal = formals, q = NULL;
     int i = 0;
 
     p->name = name;
-    p->locals = NULL;
+    p->formals = NULL;
+    p->locals.head = p->locals.tail = NULL;
     p->local_count = 0;
     for (; formal; formal = formal->next, i++)
     {
@@ -86,27 +87,30 @@ fr_access_t fr_alloc_local(frame_t fr, bool escape)
     }
     else
         access = in_reg(temp());
-    if (fr->locals)
-    {
-        list_t p = fr->locals;
-        while (p->next)
-            p = p->next;
-        p->next = list(access, NULL);
-    }
-    else
-        fr->locals = list(access, NULL);
+    list_enqueue(&fr->locals, list(access, NULL));
     return access;
 }
 
+void fr_clear_locals(frame_t fr)
+{
+    fr->locals.head = fr->locals.tail = NULL;
+    fr->local_count = 0;
+}
+
 int fr_offset(fr_access_t access)
 {
     assert(access && access->kind == FR_IN_FRAME);
     return access->u.offset;
 }
 
+bool fr_in_frame(fr_access_t access)
+{
+    return access->kind == FR_IN_FRAME;
+}
+
 fr_frag_t fr_string_frag(tmp_label_t label, string_t string)
 {
-    fr_frag_t p = checked_malloc(sizeof(*p));
+    fr_frag_t p = unit_alloc(sizeof(*p));
     p->kind = FR_STRING_FRAG;
     p->u.string.label = label;
     p->u.string.string = string;
@@ -115,48 +119,64 @@ fr_frag_t fr_string_frag(tmp_label_t label, string_t string)
 
 fr_frag_t fr_proc_frag(ir_stmt_t stmt, frame_t frame)
 {
-    fr_frag_t p = checked_malloc(sizeof(*p));
+    fr_frag_t p = unit_alloc(sizeof(*p));
     p->kind = FR_PROC_FRAG;
     p->u.proc.stmt = stmt;
     p->u.proc.frame = frame;
     return p;
 }
 
-static list_t _string_frags = NULL;
-static list_t _proc_frags = NULL;
+static THREAD_LOCAL list_queue_t _string_frags = { NULL, NULL };
+static THREAD_LOCAL list_queue_t _proc_frags = { NULL, NULL };
+static THREAD_LOCAL temp_t _fp = 0;
+static THREAD_LOCAL temp_t _rv = 0;
+
+void fr_reset(void)
+{
+    _string_frags.head = _string_frags.tail = NULL;
+    _proc_frags.head = _proc_frags.tail = NULL;
+    _fp = 0;
+    _rv = 0;
+}
 
 void fr_add_frag(fr_frag_t frag)
 {
     switch (frag->kind)
     {
         case FR_STRING_FRAG:
-            _string_frags = list_append(_string_frags, frag);
+            list_enqueue(&_string_frags, list(frag, NULL));
             break;
         case FR_PROC_FRAG:
-            _proc_frags = list_append(_proc_frags, frag);
+            list_enqueue(&_proc_frags, list(frag, NULL));
             break;
         default:
             assert(false);
     }
 }
 
-temp_t fr_fp(void)
+list_t fr_string_frags(void)
+{
+    return _string_frags.head;
+}
+
+list_t fr_proc_frags(void)
 {
-    static temp_t _fp = NULL;
+    return _proc_frags.head;
+}
 
+/* A task stands in for the registers with temps of its own until it is
+ * merged, when they are made, or found, on the unit's thread. */
+temp_t fr_fp(void)
+{
     if (!_fp)
-        _fp = temp();
+        _fp = tmp_in_task() ? tmp_deferred(fr_fp) : temp();
     return _fp;
 }
 
 temp_t fr_rv(void)
 {
-    static temp_t _rv = NULL;
-
     if (!_rv)
-    {
-        _rv = temp();
-    }
+        _rv = tmp_in_task() ? tmp_deferred(fr_rv) : temp();
     return _rv;
 }
 
@@ -188,7 +208,7 @@ void fr_pp_frags(FILE *out)
     list_t p;
 
     fprintf(out, "STRING FRAGMENTS:\n");
-    for (p = _string_frags; p; p = p->next)
+    for (p = _string_frags.head; p; p = p->next)
     {
         fr_frag_t frag = p->data;
         fprintf(out, "    %s: \"%s\"\n",
@@ -198,7 +218,7 @@ void fr_pp_frags(FILE *out)
     fprintf(out, "\n");
 
     fprintf(out, "FUNCTION FRAGMENTS:\n");
-    for (p = _proc_frags; p; p = p->next)
+    for (p = _proc_frags.head; p; p = p->next)
     {
         fr_frag_t frag = p->data;
         fprintf(out, "    %s:\n", tmp_name(frag->u.proc.frame->name));
@@ -207,6 +227,40 @@ void fr_pp_frags(FILE *out)
     fprintf(out, "\n");
 }
 
+static void relocate_accesses(list_t accesses, tmp_task_t task)
+{
+    for (; accesses; accesses = accesses->next)
+    {
+        fr_access_t access = accesses->data;
+        if (access->kind == FR_IN_REG)
+            access->u.reg = tmp_relocate(task, access->u.reg);
+    }
+}
+
+static void relocate_frame(frame_t fr, tmp_task_t task)
+{
+    fr->name = tmp_relocate_label(task, fr->name);
+    relocate_accesses(fr->formals, task);
+    relocate_accesses(fr->locals.head, task);
+}
+
+void fr_relocate_frag(fr_frag_t frag, tmp_task_t task)
+{
+    switch (frag->kind)
+    {
+        case FR_STRING_FRAG:
+            frag->u.string.label =
+                tmp_relocate_label(task, frag->u.string.label);
+            break;
+        case FR_PROC_FRAG:
+            ir_relocate_stmt(frag->u.proc.stmt, task);
+            relocate_frame(frag->u.proc.frame, task);
+            break;
+        default:
+            assert(false);
+    }
+}
+
 ir_stmt_t fr_proc_entry_exit_1(frame_t fr, ir_stmt_t stmt)
 {
     return stmt;
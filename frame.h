@@ -12,7 +12,9 @@ frame_t frame(tmp_label_t name, list_t formals);
 tmp_label_t fr_name(frame_t fr);
 list_t fr_formals(frame_t fr);
 fr_access_t fr_alloc_local(frame_t fr, bool escape);
+void fr_clear_locals(frame_t fr);
 int fr_offset(fr_access_t access);
+bool fr_in_frame(fr_access_t access);
 
 typedef struct fr_frag_s *fr_frag_t;
 struct fr_frag_s
@@ -27,11 +29,16 @@ struct fr_frag_s
 fr_frag_t fr_string_frag(tmp_label_t label, string_t string);
 fr_frag_t fr_proc_frag(ir_stmt_t stmt, frame_t frame);
 void fr_add_frag(fr_frag_t frag);
+list_t fr_string_frags(void);
+list_t fr_proc_frags(void);
+/* Forget the fragments and registers of the previous compilation unit. */
+void fr_reset(void);
 
 extern const int FR_WORD_SIZE;
 temp_t fr_fp(void);
 temp_t fr_rv(void);
 
+/* frame_ptr may be NULL for an access that is not in a frame. */
 ir_expr_t fr_expr(fr_access_t access, ir_expr_t frame_ptr);
 ir_expr_t fr_external_call(string_t name, list_t args);
 
@@ -39,4 +46,8 @@ ir_stmt_t fr_proc_entry_exit_1(frame_t fr, ir_stmt_t stmt);
 
 void fr_pp_frags(FILE *out);
 
+/* Rewrite the temps and labels a task made in a fragment, and in its
+ * frame, once the task has been merged. */
+void fr_relocate_frag(fr_frag_t frag, tmp_task_t task);
+
 #endif
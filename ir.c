@@ -1,8 +1,10 @@
+#include <limits.h>
+
 #include "ir.h"
 
 ir_stmt_t ir_seq_stmt(list_t seq)
 {
-    ir_stmt_t p = checked_malloc(sizeof(*p));
+    ir_stmt_t p = slab_alloc(ALLOC_IR_STMT, sizeof(*p));
     p->kind = IR_SEQ;
     p->u.seq = seq;
     return p;
@@ -10,7 +12,7 @@ ir_stmt_t ir_seq_stmt(list_t seq)
 
 ir_stmt_t ir_label_stmt(tmp_label_t label)
 {
-    ir_stmt_t p = checked_malloc(sizeof(*p));
+    ir_stmt_t p = slab_alloc(ALLOC_IR_STMT, sizeof(*p));
     p->kind = IR_LABEL;
     p->u.label = label;
     return p;
@@ -18,7 +20,7 @@ ir_stmt_t ir_label_stmt(tmp_label_t label)
 
 ir_stmt_t ir_jump_stmt(ir_expr_t expr, list_t jumps)
 {
-    ir_stmt_t p = checked_malloc(sizeof(*p));
+    ir_stmt_t p = slab_alloc(ALLOC_IR_STMT, sizeof(*p));
     p->kind = IR_JUMP;
     p->u.jump.expr = expr;
     p->u.jump.jumps = jumps;
@@ -31,7 +33,7 @@ ir_stmt_t ir_cjump_stmt(ir_relop_t op,
                         tmp_label_t t,
                         tmp_label_t f)
 {
-    ir_stmt_t p = checked_malloc(sizeof(*p));
+    ir_stmt_t p = slab_alloc(ALLOC_IR_STMT, sizeof(*p));
     p->kind = IR_CJUMP;
     p->u.cjump.op = op;
     p->u.cjump.left = left;
@@ -43,7 +45,7 @@ ir_stmt_t ir_cjump_stmt(ir_relop_t op,
 
 ir_stmt_t ir_move_stmt(ir_expr_t dst, ir_expr_t src)
 {
-    ir_stmt_t p = checked_malloc(sizeof(*p));
+    ir_stmt_t p = slab_alloc(ALLOC_IR_STMT, sizeof(*p));
     p->kind = IR_MOVE;
     p->u.move.dst = dst;
     p->u.move.src = src;
@@ -52,15 +54,151 @@ ir_stmt_t ir_move_stmt(ir_expr_t dst, ir_expr_t src)
 
 ir_stmt_t ir_expr_stmt(ir_expr_t expr)
 {
-    ir_stmt_t p = checked_malloc(sizeof(*p));
+    ir_stmt_t p = slab_alloc(ALLOC_IR_STMT, sizeof(*p));
     p->kind = IR_EXPR;
     p->u.expr = expr;
     return p;
 }
 
+/* Arithmetic wraps the way the target's 32-bit words do.  Division by
+ * zero, the one division that overflows and shifts by no less than a word
+ * are left for run time. */
+static bool fold_const(ir_binop_t op, int left, int right, int *result)
+{
+    unsigned int l = left, r = right;
+
+    switch (op)
+    {
+        case IR_PLUS:
+            *result = (int) (l + r);
+            return true;
+        case IR_MINUS:
+            *result = (int) (l - r);
+            return true;
+        case IR_MUL:
+            *result = (int) (l * r);
+            return true;
+        case IR_DIV:
+            if (right == 0 || (left == INT_MIN && right == -1))
+                return false;
+            *result = left / right;
+            return true;
+        case IR_AND:
+            *result = left & right;
+            return true;
+        case IR_OR:
+            *result = left | right;
+            return true;
+        case IR_XOR:
+            *result = left ^ right;
+            return true;
+        case IR_LSHIFT:
+        case IR_RSHIFT:
+        case IR_ARSHIFT:
+            if (right < 0 || right >= 32)
+                return false;
+            if (op == IR_LSHIFT)
+                *result = (int) (l << r);
+            else if (op == IR_RSHIFT)
+                *result = (int) (l >> r);
+            else
+                *result = left >> right;
+            return true;
+    }
+    return false;
+}
+
+/* The log of a power of two above one, or else -1. */
+static int log2_const(ir_expr_t expr)
+{
+    unsigned int c;
+    int k = 0;
+
+    if (expr->kind != IR_CONST || expr->u.const_ <= 1
+        || (expr->u.const_ & (expr->u.const_ - 1)))
+        return -1;
+    for (c = expr->u.const_; c > 1; c >>= 1)
+        k++;
+    return k;
+}
+
+/* Whether dropping expr drops nothing it does. */
+static bool is_pure(ir_expr_t expr)
+{
+    return expr->kind == IR_CONST || expr->kind == IR_TMP
+        || expr->kind == IR_NAME;
+}
+
+/* x op c for a constant c, or NULL if nothing simpler does. */
+static ir_expr_t fold_right(ir_binop_t op, ir_expr_t x, ir_expr_t c)
+{
+    int k, v = c->u.const_;
+
+    switch (op)
+    {
+        case IR_PLUS:
+        case IR_MINUS:
+            if (v == 0)
+                return x;
+            /* (y + c1) + c and (y + c1) - c add one constant to y. */
+            if (x->kind == IR_BINOP && x->u.binop.op == IR_PLUS)
+            {
+                ir_expr_t y = x->u.binop.left, c1 = x->u.binop.right;
+
+                if (y->kind == IR_CONST)
+                {
+                    c1 = y;
+                    y = x->u.binop.right;
+                }
+                if (c1->kind == IR_CONST)
+                    return ir_binop_expr(
+                        IR_PLUS, y,
+                        ir_const_expr(op == IR_PLUS
+                                      ? (int) ((unsigned int) c1->u.const_ + v)
+                                      : (int) ((unsigned int) c1->u.const_
+                                               - v)));
+            }
+            return NULL;
+        case IR_MUL:
+            if (v == 1)
+                return x;
+            if (v == 0 && is_pure(x))
+                return c;
+            k = log2_const(c);
+            return k < 0 ? NULL
+                : ir_binop_expr(IR_LSHIFT, x, ir_const_expr(k));
+        case IR_DIV:
+            return v == 1 ? x : NULL;
+        case IR_AND:
+            return v == 0 && is_pure(x) ? c : NULL;
+        case IR_OR:
+        case IR_XOR:
+        case IR_LSHIFT:
+        case IR_RSHIFT:
+        case IR_ARSHIFT:
+            return v == 0 ? x : NULL;
+    }
+    return NULL;
+}
+
 ir_expr_t ir_binop_expr(ir_binop_t op, ir_expr_t left, ir_expr_t right)
 {
-    ir_expr_t p = checked_malloc(sizeof(*p));
+    ir_expr_t p;
+    int v;
+
+    if (left->kind == IR_CONST && right->kind == IR_CONST
+        && fold_const(op, left->u.const_, right->u.const_, &v))
+        return ir_const_expr(v);
+    if (right->kind == IR_CONST && (p = fold_right(op, left, right)))
+        return p;
+    /* The commutative ones with the constant on the left fold the same. */
+    if (left->kind == IR_CONST
+        && (op == IR_PLUS || op == IR_MUL || op == IR_AND || op == IR_OR
+            || op == IR_XOR)
+        && (p = fold_right(op, right, left)))
+        return p;
+
+    p = slab_alloc(ALLOC_IR_EXPR, sizeof(*p));
     p->kind = IR_BINOP;
     p->u.binop.op = op;
     p->u.binop.left = left;
@@ -70,7 +208,7 @@ ir_expr_t ir_binop_expr(ir_binop_t op, ir_expr_t left, ir_expr_t right)
 
 ir_expr_t ir_mem_expr(ir_expr_t mem)
 {
-    ir_expr_t p = checked_malloc(sizeof(*p));
+    ir_expr_t p = slab_alloc(ALLOC_IR_EXPR, sizeof(*p));
     p->kind = IR_MEM;
     p->u.mem = mem;
     return p;
@@ -78,7 +216,7 @@ ir_expr_t ir_mem_expr(ir_expr_t mem)
 
 ir_expr_t ir_tmp_expr(temp_t tmp)
 {
-    ir_expr_t p = checked_malloc(sizeof(*p));
+    ir_expr_t p = slab_alloc(ALLOC_IR_EXPR, sizeof(*p));
     p->kind = IR_TMP;
     p->u.tmp = tmp;
     return p;
@@ -86,7 +224,7 @@ ir_expr_t ir_tmp_expr(temp_t tmp)
 
 ir_expr_t ir_eseq_expr(ir_stmt_t stmt, ir_expr_t expr)
 {
-    ir_expr_t p = checked_malloc(sizeof(*p));
+    ir_expr_t p = slab_alloc(ALLOC_IR_EXPR, sizeof(*p));
     p->kind = IR_ESEQ;
     p->u.eseq.stmt = stmt;
     p->u.eseq.expr = expr;
@@ -95,7 +233,7 @@ ir_expr_t ir_eseq_expr(ir_stmt_t stmt, ir_expr_t expr)
 
 ir_expr_t ir_name_expr(tmp_label_t name)
 {
-    ir_expr_t p = checked_malloc(sizeof(*p));
+    ir_expr_t p = slab_alloc(ALLOC_IR_EXPR, sizeof(*p));
     p->kind = IR_NAME;
     p->u.name = name;
     return p;
@@ -103,7 +241,7 @@ ir_expr_t ir_name_expr(tmp_label_t name)
 
 ir_expr_t ir_const_expr(int const_)
 {
-    ir_expr_t p = checked_malloc(sizeof(*p));
+    ir_expr_t p = slab_alloc(ALLOC_IR_EXPR, sizeof(*p));
     p->kind = IR_CONST;
     p->u.const_ = const_;
     return p;
@@ -111,9 +249,158 @@ ir_expr_t ir_const_expr(int const_)
 
 ir_expr_t ir_call_expr(ir_expr_t func, list_t args)
 {
-    ir_expr_t p = checked_malloc(sizeof(*p));
+    ir_expr_t p = slab_alloc(ALLOC_IR_EXPR, sizeof(*p));
     p->kind = IR_CALL;
     p->u.call.func = func;
     p->u.call.args = args;
     return p;
 }
+
+bool ir_compare(ir_relop_t op, int left, int right)
+{
+    unsigned int l = left, r = right;
+
+    switch (op)
+    {
+        case IR_EQ:
+            return left == right;
+        case IR_NE:
+            return left != right;
+        case IR_LT:
+            return left < right;
+        case IR_LE:
+            return left <= right;
+        case IR_GT:
+            return left > right;
+        case IR_GE:
+            return left >= right;
+        case IR_ULT:
+            return l < r;
+        case IR_ULE:
+            return l <= r;
+        case IR_UGT:
+            return l > r;
+        case IR_UGE:
+            return l >= r;
+    }
+    assert(0);
+    return false;
+}
+
+/* Trees are as deep as the program's expressions, so relocation keeps the
+ * nodes left to do on a stack of its own rather than recursing. */
+typedef struct relocate_item_s relocate_item_t;
+struct relocate_item_s
+{
+    bool stmt;
+    void *node;
+};
+
+static THREAD_LOCAL relocate_item_t *_relocating;
+static THREAD_LOCAL int _relocate_count, _relocate_cap;
+
+static void push_relocate(bool stmt, void *node)
+{
+    if (!node)
+        return;
+    if (_relocate_count == _relocate_cap)
+        _relocating = grow_array(_relocating, _relocate_count,
+                                 &_relocate_cap, sizeof(*_relocating));
+    _relocating[_relocate_count].stmt = stmt;
+    _relocating[_relocate_count].node = node;
+    _relocate_count++;
+}
+
+static void relocate_stmt(ir_stmt_t stmt, tmp_task_t task)
+{
+    list_t p;
+
+    switch (stmt->kind)
+    {
+        case IR_SEQ:
+            for (p = stmt->u.seq; p; p = p->next)
+                push_relocate(true, p->data);
+            break;
+        case IR_LABEL:
+            stmt->u.label = tmp_relocate_label(task, stmt->u.label);
+            break;
+        case IR_JUMP:
+            push_relocate(false, stmt->u.jump.expr);
+            for (p = stmt->u.jump.jumps; p; p = p->next)
+                p->data = tmp_relocate_label(task, p->data);
+            break;
+        case IR_CJUMP:
+            push_relocate(false, stmt->u.cjump.left);
+            push_relocate(false, stmt->u.cjump.right);
+            stmt->u.cjump.t = tmp_relocate_label(task, stmt->u.cjump.t);
+            stmt->u.cjump.f = tmp_relocate_label(task, stmt->u.cjump.f);
+            break;
+        case IR_MOVE:
+            push_relocate(false, stmt->u.move.dst);
+            push_relocate(false, stmt->u.move.src);
+            break;
+        case IR_EXPR:
+            push_relocate(false, stmt->u.expr);
+            break;
+    }
+}
+
+static void relocate_expr(ir_expr_t expr, tmp_task_t task)
+{
+    list_t p;
+
+    switch (expr->kind)
+    {
+        case IR_BINOP:
+            push_relocate(false, expr->u.binop.left);
+            push_relocate(false, expr->u.binop.right);
+            break;
+        case IR_MEM:
+            push_relocate(false, expr->u.mem);
+            break;
+        case IR_TMP:
+            expr->u.tmp = tmp_relocate(task, expr->u.tmp);
+            break;
+        case IR_ESEQ:
+            push_relocate(true, expr->u.eseq.stmt);
+            push_relocate(false, expr->u.eseq.expr);
+            break;
+        case IR_NAME:
+            expr->u.name = tmp_relocate_label(task, expr->u.name);
+            break;
+        case IR_CONST:
+            break;
+        case IR_CALL:
+            push_relocate(false, expr->u.call.func);
+            for (p = expr->u.call.args; p; p = p->next)
+                push_relocate(false, p->data);
+            break;
+    }
+}
+
+/* The order nodes are rewritten in makes no difference. */
+static void relocate(bool stmt, void *node, tmp_task_t task)
+{
+    int base = _relocate_count;
+
+    push_relocate(stmt, node);
+    while (_relocate_count > base)
+    {
+        relocate_item_t item = _relocating[--_relocate_count];
+
+        if (item.stmt)
+            relocate_stmt(item.node, task);
+        else
+            relocate_expr(item.node, task);
+    }
+}
+
+void ir_relocate_stmt(ir_stmt_t stmt, tmp_task_t task)
+{
+    relocate(true, stmt, task);
+}
+
+void ir_relocate_expr(ir_expr_t expr, tmp_task_t task)
+{
+    relocate(false, expr, task);
+}
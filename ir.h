@@ -56,6 +56,8 @@ struct ir_expr_s
         struct { ir_expr_t func; list_t args; } call;
     } u;
 };
+/* Folds constant operands and simplifies identities such as x+0 and x*1,
+ * so the node returned need not be a BINOP. */
 ir_expr_t ir_binop_expr(ir_binop_t op, ir_expr_t left, ir_expr_t right);
 ir_expr_t ir_mem_expr(ir_expr_t mem);
 ir_expr_t ir_tmp_expr(temp_t tmp);
@@ -64,4 +66,12 @@ ir_expr_t ir_name_expr(tmp_label_t name);
 ir_expr_t ir_const_expr(int const_);
 ir_expr_t ir_call_expr(ir_expr_t func, list_t args);
 
+/* Whether left op right holds, for folding comparisons of constants. */
+bool ir_compare(ir_relop_t op, int left, int right);
+
+/* Rewrite the temps and labels of a merged task in a tree it built.  A
+ * node reached twice is rewritten only once in effect. */
+void ir_relocate_stmt(ir_stmt_t stmt, tmp_task_t task);
+void ir_relocate_expr(ir_expr_t expr, tmp_task_t task);
+
 #endif
@@ -0,0 +1,19 @@
+#ifndef INCLUDE__LEXER_H
+#define INCLUDE__LEXER_H
+
+#include "parser-wrap.h"
+#include "utils.h"
+
+/* Scan regular files through mmap instead of stdio; on by default. */
+extern bool lex_mmap;
+
+/* Each open creates a scanner of its own, which lex_close destroys. */
+bool lex_open(yyscan_t *scanner, string_t filename);
+void lex_open_buffer(yyscan_t *scanner, const char *buf, int len);
+/* Number what the scanner reads next from pos on, rather than from 1, for
+ * a fragment of a longer source that runs up to the token after it. */
+void lex_set_pos(yyscan_t scanner, int pos);
+void lex_close(yyscan_t scanner);
+int yylex(YYSTYPE *lval, yyscan_t scanner);
+
+#endif
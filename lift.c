@@ -0,0 +1,702 @@
+#include <stdlib.h>
+
+#include "lift.h"
+#include "symbol.h"
+
+bool lift_enabled = false;
+
+/* A variable, parameter or loop variable, and the function it belongs to;
+ * the program's body is function 0. */
+typedef struct lift_var_s *lift_var_t;
+struct lift_var_s
+{
+    symbol_t name;
+    int func;
+    bool *escape;
+    bool assigned;
+};
+
+/* The free variables of a function are those of enclosing functions used
+ * in its body, its nested functions' included, or passed from there to a
+ * lifted function.  They are kept in the order found, and indexed by an
+ * open-addressed table of their positions. */
+typedef struct lift_func_s lift_func_t;
+struct lift_func_s
+{
+    ast_func_t func;
+    int parent;
+    bool lifted;
+    lift_var_t *free;
+    int free_count;
+    int free_cap;
+    int *index;
+    int mask;
+    /* The extra parameters of a lifted function, one per free variable. */
+    ast_field_t *fields;
+    /* The calls to this function, as positions in _calls. */
+    int *callers;
+    int caller_count;
+    int caller_cap;
+};
+
+/* A use of var, or a call of callee, in the body of function site. */
+typedef struct lift_use_s lift_use_t;
+struct lift_use_s
+{
+    lift_var_t var;
+    int site;
+};
+
+typedef struct lift_call_s lift_call_t;
+struct lift_call_s
+{
+    int callee;
+    int site;
+};
+
+/* What a name is bound to while walking: a variable, or else a function. */
+typedef struct lift_bind_s *lift_bind_t;
+struct lift_bind_s
+{
+    lift_var_t var;
+    int func;
+};
+
+static THREAD_LOCAL arena_t _arena;
+static THREAD_LOCAL sym_table_t _env;
+
+static THREAD_LOCAL lift_func_t *_funcs;
+static THREAD_LOCAL int _func_count, _func_cap;
+static THREAD_LOCAL lift_var_t *_vars;
+static THREAD_LOCAL int _var_count, _var_cap;
+static THREAD_LOCAL lift_use_t *_uses;
+static THREAD_LOCAL int _use_count, _use_cap;
+static THREAD_LOCAL lift_call_t *_calls;
+static THREAD_LOCAL int _call_count, _call_cap;
+
+/* The walk is made once to find the functions, variables, uses and calls,
+ * then again after each round of lifting that leaves variables to pass, to
+ * check that at each call the names of those variables see them.  The
+ * later times around, functions and variables come up in the same order
+ * and are numbered as before. */
+static THREAD_LOCAL bool _checking;
+static THREAD_LOCAL bool _changed;
+static THREAD_LOCAL int _site;
+static THREAD_LOCAL int _next_func, _next_var;
+
+static int add_func(ast_func_t func, int parent)
+{
+    lift_func_t *f;
+
+    if (_func_count == _func_cap)
+        _funcs = grow_array(_funcs, _func_count, &_func_cap, sizeof(*_funcs));
+    f = &_funcs[_func_count];
+    f->func = func;
+    f->parent = parent;
+    f->lifted = func != NULL;
+    f->free = NULL;
+    f->free_count = f->free_cap = 0;
+    f->index = NULL;
+    f->mask = 0;
+    f->fields = NULL;
+    f->callers = NULL;
+    f->caller_count = f->caller_cap = 0;
+    return _func_count++;
+}
+
+static lift_bind_t bind(lift_var_t var, int func)
+{
+    lift_bind_t p = arena_alloc(_arena, sizeof(*p));
+    p->var = var;
+    p->func = func;
+    return p;
+}
+
+static void declare_var(symbol_t name, bool *escape)
+{
+    lift_var_t var;
+
+    if (_checking)
+        var = _vars[_next_var++];
+    else
+    {
+        var = arena_alloc(_arena, sizeof(*var));
+        var->name = name;
+        var->func = _site;
+        var->escape = escape;
+        var->assigned = false;
+        if (_var_count == _var_cap)
+            _vars = grow_array(_vars, _var_count, &_var_cap, sizeof(*_vars));
+        _vars[_var_count++] = var;
+    }
+    sym_enter(_env, name, bind(var, 0));
+}
+
+static lift_var_t lookup_var(symbol_t name)
+{
+    lift_bind_t b = sym_lookup(_env, name);
+    return b ? b->var : NULL;
+}
+
+static void use_var(symbol_t name)
+{
+    lift_var_t var = lookup_var(name);
+
+    if (!var || _checking)
+        return;
+    if (_use_count == _use_cap)
+        _uses = grow_array(_uses, _use_count, &_use_cap, sizeof(*_uses));
+    _uses[_use_count].var = var;
+    _uses[_use_count].site = _site;
+    _use_count++;
+}
+
+static void call_func(symbol_t name)
+{
+    lift_bind_t b = sym_lookup(_env, name);
+    lift_func_t *f;
+    int i;
+
+    /* The library's functions are bound by no declaration. */
+    if (!b || b->var)
+        return;
+    f = &_funcs[b->func];
+    if (_checking)
+    {
+        for (i = 0; f->lifted && i < f->free_count; i++)
+            if (lookup_var(f->free[i]->name) != f->free[i])
+            {
+                f->lifted = false;
+                _changed = true;
+            }
+        return;
+    }
+    if (_call_count == _call_cap)
+        _calls = grow_array(_calls, _call_count, &_call_cap, sizeof(*_calls));
+    _calls[_call_count].callee = b->func;
+    _calls[_call_count].site = _site;
+    if (f->caller_count == f->caller_cap)
+        f->callers = grow_array(f->callers, f->caller_count, &f->caller_cap,
+                                sizeof(*f->callers));
+    f->callers[f->caller_count++] = _call_count++;
+}
+
+/* The walk keeps what is left to do on a stack of its own rather than
+ * recursing, so that it needs no more of the thread's stack however deep
+ * the program nests.  A function group's bodies are taken one at a time,
+ * with the number of the next. */
+typedef struct lift_step_s lift_step_t;
+struct lift_step_s
+{
+    enum
+    {
+        LIFT_EXPR, LIFT_DECLS, LIFT_BODIES, LIFT_EFIELDS, LIFT_BEGIN_SCOPE,
+        LIFT_END_SCOPE, LIFT_END_BODY, LIFT_DECLARE,
+    } kind;
+    union
+    {
+        ast_expr_t expr;
+        struct { list_t list; int func; } list;
+        struct { symbol_t var; bool *escape; } declare;
+        int site;
+    } u;
+};
+
+static THREAD_LOCAL lift_step_t *_steps;
+static THREAD_LOCAL int _step_count, _step_cap;
+
+static lift_step_t *push(int kind)
+{
+    if (_step_count == _step_cap)
+        _steps = grow_array(_steps, _step_count, &_step_cap, sizeof(*_steps));
+    _steps[_step_count].kind = kind;
+    return &_steps[_step_count++];
+}
+
+static void push_expr(ast_expr_t expr)
+{
+    push(LIFT_EXPR)->u.expr = expr;
+}
+
+static void push_list(int kind, list_t list, int func)
+{
+    lift_step_t *step;
+
+    if (!list)
+        return;
+    step = push(kind);
+    step->u.list.list = list;
+    step->u.list.func = func;
+}
+
+static void push_declare(symbol_t var, bool *escape)
+{
+    lift_step_t *step = push(LIFT_DECLARE);
+    step->u.declare.var = var;
+    step->u.declare.escape = escape;
+}
+
+/* The variable at the bottom of var is used first, then the subscripts
+ * are walked from the innermost out; the steps pushed here run before
+ * any pushed earlier. */
+static void walk_var(ast_var_t var)
+{
+    for (; ast_var_kind(var) != AST_SIMPLE_VAR; var = ast_var_base(var))
+        if (ast_var_kind(var) == AST_SUB_VAR)
+            push_expr(ast_var_sub(var));
+    use_var(ast_var_name(var));
+}
+
+static void visit_funcs(list_t funcs)
+{
+    list_t p;
+    int first = _checking ? _next_func : _func_count, i;
+
+    /* The group's names are in scope in all of its bodies. */
+    for (p = funcs, i = first; p; p = p->next, i++)
+    {
+        ast_func_t func = p->data;
+
+        if (_checking)
+            _next_func++;
+        else
+            add_func(func, _site);
+        sym_enter(_env, func->name, bind(NULL, i));
+    }
+    push_list(LIFT_BODIES, funcs, first);
+}
+
+static void visit_body(ast_func_t func, int i)
+{
+    list_t q;
+
+    push(LIFT_END_BODY)->u.site = _site;
+    _site = i;
+    sym_begin_scope(_env);
+    for (q = func->params; q; q = q->next)
+    {
+        ast_field_t field = q->data;
+        declare_var(field->name, &field->escape);
+    }
+    push_expr(func->body);
+}
+
+static void visit_decl(ast_decl_t decl)
+{
+    if (decl->kind == AST_FUNCS_DECL)
+        visit_funcs(decl->u.funcs);
+    else if (decl->kind == AST_VAR_DECL)
+    {
+        /* The variable is not in scope in its own initializer. */
+        push_declare(decl->u.var.var, &decl->u.var.escape);
+        push_expr(decl->u.var.init);
+    }
+}
+
+/* Push the steps for expr, the last to run first. */
+static void visit_expr(ast_expr_t expr)
+{
+    int i;
+
+    switch (ast_kind(expr))
+    {
+        case AST_NIL_EXPR:
+        case AST_NUM_EXPR:
+        case AST_STRING_EXPR:
+        case AST_BREAK_EXPR:
+            break;
+
+        case AST_VAR_EXPR:
+            walk_var(ast_var(expr));
+            break;
+
+        case AST_CALL_EXPR:
+            call_func(ast_call(expr)->func);
+            for (i = ast_call(expr)->count - 1; i >= 0; i--)
+                push_expr(ast_kid(ast_call(expr)->first, i));
+            break;
+
+        case AST_OP_EXPR:
+            push_expr(ast_op(expr)->right);
+            push_expr(ast_op(expr)->left);
+            break;
+
+        case AST_RECORD_EXPR:
+            push_list(LIFT_EFIELDS, ast_record(expr)->efields, 0);
+            break;
+
+        case AST_ARRAY_EXPR:
+            push_expr(ast_array(expr)->init);
+            push_expr(ast_array(expr)->size);
+            break;
+
+        case AST_SEQ_EXPR:
+            for (i = ast_seq(expr)->count - 1; i >= 0; i--)
+                push_expr(ast_kid(ast_seq(expr)->first, i));
+            break;
+
+        case AST_IF_EXPR:
+            if (ast_if(expr)->else_)
+                push_expr(ast_if(expr)->else_);
+            push_expr(ast_if(expr)->then);
+            push_expr(ast_if(expr)->cond);
+            break;
+
+        case AST_WHILE_EXPR:
+            push_expr(ast_while(expr)->body);
+            push_expr(ast_while(expr)->cond);
+            break;
+
+        case AST_FOR_EXPR:
+            push(LIFT_END_SCOPE);
+            push_expr(ast_for(expr)->body);
+            push_declare(ast_for(expr)->var, &ast_for(expr)->escape);
+            push(LIFT_BEGIN_SCOPE);
+            push_expr(ast_for(expr)->hi);
+            push_expr(ast_for(expr)->lo);
+            break;
+
+        case AST_LET_EXPR:
+            sym_begin_scope(_env);
+            push(LIFT_END_SCOPE);
+            push_expr(ast_let(expr)->body);
+            push_list(LIFT_DECLS, ast_let(expr)->decls, 0);
+            break;
+
+        case AST_ASSIGN_EXPR: {
+            ast_var_t target = ast_assign(expr)->var;
+
+            if (ast_var_kind(target) == AST_SIMPLE_VAR && !_checking)
+            {
+                lift_var_t var = lookup_var(ast_var_name(target));
+                if (var)
+                    var->assigned = true;
+            }
+            push_expr(ast_assign(expr)->expr);
+            walk_var(target);
+            break;
+        }
+    }
+}
+
+static void traverse_expr(ast_expr_t expr)
+{
+    int base = _step_count;
+
+    push_expr(expr);
+    while (_step_count > base)
+    {
+        lift_step_t step = _steps[--_step_count];
+        list_t p;
+
+        switch (step.kind)
+        {
+            case LIFT_EXPR:
+                visit_expr(step.u.expr);
+                break;
+
+            case LIFT_DECLS:
+                p = step.u.list.list;
+                push_list(LIFT_DECLS, p->next, 0);
+                visit_decl(p->data);
+                break;
+
+            case LIFT_BODIES:
+                p = step.u.list.list;
+                push_list(LIFT_BODIES, p->next, step.u.list.func + 1);
+                visit_body(p->data, step.u.list.func);
+                break;
+
+            case LIFT_EFIELDS:
+                p = step.u.list.list;
+                push_list(LIFT_EFIELDS, p->next, 0);
+                push_expr(((ast_efield_t) p->data)->expr);
+                break;
+
+            case LIFT_BEGIN_SCOPE:
+                sym_begin_scope(_env);
+                break;
+
+            case LIFT_END_SCOPE:
+                sym_end_scope(_env);
+                break;
+
+            case LIFT_END_BODY:
+                sym_end_scope(_env);
+                _site = step.u.site;
+                break;
+
+            case LIFT_DECLARE:
+                declare_var(step.u.declare.var, step.u.declare.escape);
+                break;
+        }
+    }
+}
+
+static int find_free(lift_func_t *f, lift_var_t var)
+{
+    unsigned int i;
+
+    if (!f->mask)
+        return -1;
+    for (i = ptr_hash(var) & f->mask; f->index[i] >= 0; i = (i + 1) & f->mask)
+        if (f->free[f->index[i]] == var)
+            return f->index[i];
+    return -1;
+}
+
+static void index_free(lift_func_t *f, int pos)
+{
+    unsigned int i = ptr_hash(f->free[pos]) & f->mask;
+
+    while (f->index[i] >= 0)
+        i = (i + 1) & f->mask;
+    f->index[i] = pos;
+}
+
+/* Add var to f's free variables, unless it is there already. */
+static bool add_free(lift_func_t *f, lift_var_t var)
+{
+    int i;
+
+    if (find_free(f, var) >= 0)
+        return false;
+    if (f->free_count == f->free_cap)
+        f->free = grow_array(f->free, f->free_count, &f->free_cap,
+                             sizeof(*f->free));
+    f->free[f->free_count++] = var;
+    /* Keep the table at most half full. */
+    if (f->free_count * 2 > f->mask)
+    {
+        free(f->index);
+        f->mask = f->mask ? f->mask * 2 + 1 : 7;
+        while (f->free_count * 2 > f->mask)
+            f->mask = f->mask * 2 + 1;
+        f->index = checked_malloc((f->mask + 1) * sizeof(*f->index));
+        for (i = 0; i <= f->mask; i++)
+            f->index[i] = -1;
+        for (i = 0; i < f->free_count; i++)
+            index_free(f, i);
+    }
+    else
+        index_free(f, f->free_count - 1);
+    return true;
+}
+
+static void clear_free(lift_func_t *f)
+{
+    int i;
+
+    f->free_count = 0;
+    for (i = 0; i <= f->mask && f->index; i++)
+        f->index[i] = -1;
+}
+
+/* A variable a lifted function has newly found free, to be passed on to
+ * the functions around its calls. */
+typedef struct lift_pending_s lift_pending_t;
+struct lift_pending_s
+{
+    int func;
+    lift_var_t var;
+};
+
+static THREAD_LOCAL lift_pending_t *_pending;
+static THREAD_LOCAL int _pending_count, _pending_cap;
+
+/* A use of var at site makes it free in each function from site out to
+ * the one var belongs to.  Those further out have it already once one on
+ * the way has. */
+static void add_use(lift_var_t var, int site)
+{
+    int f;
+
+    for (f = site; f != var->func; f = _funcs[f].parent)
+    {
+        assert(f > 0);
+        if (!add_free(&_funcs[f], var))
+            break;
+        if (!_funcs[f].lifted)
+            continue;
+        if (_pending_count == _pending_cap)
+            _pending = grow_array(_pending, _pending_count, &_pending_cap,
+                                  sizeof(*_pending));
+        _pending[_pending_count].func = f;
+        _pending[_pending_count].var = var;
+        _pending_count++;
+    }
+}
+
+static void find_free_vars(void)
+{
+    int i;
+
+    for (i = 0; i < _func_count; i++)
+        clear_free(&_funcs[i]);
+    _pending_count = 0;
+    for (i = 0; i < _use_count; i++)
+        add_use(_uses[i].var, _uses[i].site);
+    while (_pending_count > 0)
+    {
+        lift_pending_t p = _pending[--_pending_count];
+        lift_func_t *f = &_funcs[p.func];
+
+        for (i = 0; i < f->caller_count; i++)
+            add_use(p.var, _calls[f->callers[i]].site);
+    }
+}
+
+/* Keep the static link of a function that uses a variable it cannot be
+ * passed, or that calls a function with a static link from outside. */
+static bool drop_lifts(void)
+{
+    bool changed = false;
+    int i, j;
+
+    for (i = 1; i < _func_count; i++)
+    {
+        lift_func_t *f = &_funcs[i];
+
+        for (j = 0; f->lifted && j < f->free_count; j++)
+            if (f->free[j]->assigned)
+            {
+                f->lifted = false;
+                changed = true;
+            }
+    }
+    for (i = 0; i < _call_count; i++)
+    {
+        lift_func_t *callee = &_funcs[_calls[i].callee];
+        int f;
+
+        if (callee->lifted)
+            continue;
+        for (f = _calls[i].site; f != callee->parent; f = _funcs[f].parent)
+        {
+            assert(f > 0);
+            if (_funcs[f].lifted)
+            {
+                _funcs[f].lifted = false;
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+/* Only calls to a lifted function with free variables need checking. */
+static bool passes_vars(void)
+{
+    int i;
+
+    for (i = 1; i < _func_count; i++)
+        if (_funcs[i].lifted && _funcs[i].free_count > 0)
+            return true;
+    return false;
+}
+
+/* A use of var at site goes to the free variable of the innermost lifted
+ * function on the way out to var's own, if there is one, and the variable
+ * escapes if the use is in a function nested in that one. */
+static void find_escape(lift_var_t var, int site)
+{
+    int f;
+
+    for (f = site; f != var->func; f = _funcs[f].parent)
+        if (_funcs[f].lifted)
+        {
+            int i = find_free(&_funcs[f], var);
+
+            assert(i >= 0);
+            if (site != f)
+                _funcs[f].fields[i]->escape = true;
+            return;
+        }
+    if (site != var->func)
+        *var->escape = true;
+}
+
+static void finish(void)
+{
+    int i, j;
+
+    for (i = 1; i < _func_count; i++)
+    {
+        lift_func_t *f = &_funcs[i];
+        list_queue_t fields = {NULL, NULL};
+
+        f->func->lifted = f->lifted;
+        if (!f->lifted)
+        {
+            f->func->free = NULL;
+            continue;
+        }
+        f->fields = checked_malloc(
+            (f->free_count ? f->free_count : 1) * sizeof(*f->fields));
+        for (j = 0; j < f->free_count; j++)
+        {
+            f->fields[j] = ast_field(f->free[j]->name, NULL);
+            list_enqueue(&fields, ast_list(f->fields[j], NULL));
+        }
+        f->func->free = fields.head;
+    }
+
+    for (i = 0; i < _var_count; i++)
+        *_vars[i]->escape = false;
+    for (i = 0; i < _use_count; i++)
+        find_escape(_uses[i].var, _uses[i].site);
+    for (i = 0; i < _call_count; i++)
+    {
+        lift_func_t *callee = &_funcs[_calls[i].callee];
+
+        for (j = 0; callee->lifted && j < callee->free_count; j++)
+            find_escape(callee->free[j], _calls[i].site);
+    }
+}
+
+static void reset(void)
+{
+    int i;
+
+    for (i = 0; i < _func_count; i++)
+    {
+        free(_funcs[i].free);
+        free(_funcs[i].index);
+        free(_funcs[i].fields);
+        free(_funcs[i].callers);
+    }
+    _func_count = _var_count = _use_count = _call_count = 0;
+    arena_reset(_arena);
+}
+
+void lift_funcs(ast_expr_t prog)
+{
+    if (!_arena)
+    {
+        _arena = arena_new();
+        _env = sym_empty();
+    }
+    _checking = false;
+    _site = add_func(NULL, -1);
+    traverse_expr(prog);
+
+    for (;;)
+    {
+        do
+            find_free_vars();
+        while (drop_lifts());
+        if (!passes_vars())
+            break;
+        _checking = true;
+        _changed = false;
+        _site = 0;
+        _next_func = 1;
+        _next_var = 0;
+        traverse_expr(prog);
+        if (!_changed)
+            break;
+    }
+
+    finish();
+    reset();
+}
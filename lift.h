@@ -0,0 +1,18 @@
+#ifndef INCLUDE__LIFT_H
+#define INCLUDE__LIFT_H
+
+#include "ast.h"
+
+/* Lift functions out of their nests before translation; off by default. */
+extern bool lift_enabled;
+
+/* Mark the functions of prog that can do without a static link as lifted,
+ * and give each the variables of enclosing functions it uses, to be passed
+ * after its own arguments.  A variable can be passed so only if nothing
+ * assigns it and every call sees it under its name; a function is lifted
+ * only if all it uses from outside can be passed and every function it
+ * calls from outside is lifted too.  Escapes are found again for the
+ * result, so this runs after esc_find_escape. */
+void lift_funcs(ast_expr_t prog);
+
+#endif
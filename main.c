@@ -1,33 +1,320 @@
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
 
 #include "ast.h"
 #include "errmsg.h"
 #include "escape.h"
+#include "lift.h"
+#include "frame.h"
+#include "lexer.h"
 #include "parser-wrap.h"
 #include "ppast.h"
 #include "semantic.h"
+#include "server.h"
+#include "temp.h"
+#include "translate.h"
 #include "utils.h"
 
-int main(int argc, char **argv)
+static void usage(string_t prog)
 {
-    ast_expr_t prog;
+    fprintf(stderr,
+            "Usage: %s [--no-mmap] [--lex-only] [--parse-only] "
+            "[--check-only] [--display] [--lift] [--no-output] "
+            "[--stats] [--body-jobs n] filename\n"
+            "       %s [--no-mmap] [--parse-only] [--check-only] "
+            "[--display] [--lift] [--no-output] [--stats] "
+            "[--body-jobs n] [-j jobs] filename...\n"
+            "       %s --serve socket [--check-only] [--display] [--lift] "
+            "[--body-jobs n] [-j jobs]\n"
+            "       %s --connect socket [--stats] filename...\n",
+            prog, prog, prog, prog);
+    exit(1);
+}
+
+static bool _parse_only = false;
+static bool _check_only = false;
+static bool _no_output = false;
+static bool _stats = false;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-    if (argc != 2)
+static void report(FILE *out, string_t phase, double start)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    fprintf(out, "%-10s %8.3fs, %ldKB peak RSS\n",
+            phase, now() - start, ru.ru_maxrss);
+}
+
+/* Run only the scanner over the file and report its throughput. */
+static void lex_only(string_t filename)
+{
+    struct stat st;
+    struct timespec start, end;
+    ast_store_t tree = ast_store_new();
+    yyscan_t scanner;
+    YYSTYPE lval;
+    double secs;
+    int tokens = 0;
+
+    em_reset(filename);
+    ast_set_store(tree);
+    if (stat(filename, &st) != 0 || !lex_open(&scanner, filename))
     {
-        fprintf(stderr, "Usage: %s filename\n", argv[0]);
+        em_error(0, "cannot open file: %s", filename);
         exit(1);
     }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (yylex(&lval, scanner))
+        tokens++;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    lex_close(scanner);
+    ast_set_store(NULL);
+    ast_store_free(tree);
+
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "%s: %d tokens, %lld bytes in %.3fs (%.1f MB/s, %s)\n",
+            filename, tokens, (long long) st.st_size, secs,
+            secs > 0 ? st.st_size / secs / 1e6 : 0.0,
+            lex_mmap ? "mmap" : "stdio");
+}
+
+/* Compile one unit on the calling thread, printing its fragments to out
+ * and its diagnostics to err.  Label and temp numbering restart for every
+ * unit, so its output does not depend on what the thread compiled before. */
+static bool compile(string_t filename, FILE *out, FILE *err)
+{
+    ast_store_t tree = ast_store_new();
+    arena_t unit = unit_set_arena(ast_store_arena(tree));
+    double start = now();
+    ast_expr_t prog;
+    bool ok = false;
+
+    tmp_reset();
+    tr_reset();
+    fr_reset();
+    sem_reset();
+    em_set_output(err);
+#ifdef ALLOC_STATS
+    alloc_reset_counts();
+#endif
 
     /* yydebug = 1; */
-    if (!(prog = parse(argv[1])) || em_any_errors)
+    prog = parse(filename, tree);
+    if (prog && !em_any_errors)
     {
-        exit(1);
+        if (_stats)
+            report(err, "parse", start);
+        ok = true;
+        if (_check_only && !_parse_only)
+        {
+            /* Escapes only matter to translation. */
+            start = now();
+            ok = sem_check_prog(prog);
+            if (_stats)
+                report(err, "check", start);
+        }
+        else if (!_parse_only)
+        {
+            start = now();
+            esc_find_escape(prog);
+            if (_stats)
+                report(err, "escape", start);
+            if (lift_enabled)
+            {
+                start = now();
+                lift_funcs(prog);
+                if (_stats)
+                    report(err, "lift", start);
+            }
+            start = now();
+            // pp_expr(stdout, 0, prog);
+            ok = sem_trans_prog(prog, _no_output ? NULL : out);
+            if (_stats)
+                report(err, "semantic", start);
+        }
+    }
+#ifdef ALLOC_STATS
+    if (_stats)
+        alloc_report(err);
+#endif
+
+    unit_set_arena(unit);
+    ast_set_store(NULL);
+    ast_store_free(tree);
+    return ok;
+}
+
+typedef struct unit_s *unit_t;
+struct unit_s
+{
+    string_t filename;
+    char *out;
+    size_t out_len;
+    char *err;
+    size_t err_len;
+    bool ok;
+};
+
+static struct unit_s *_units;
+static int _unit_count;
+static int _next_unit;
+static pthread_mutex_t _unit_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *compile_units(void *arg)
+{
+    for (;;)
+    {
+        unit_t unit;
+        FILE *out, *err;
+
+        pthread_mutex_lock(&_unit_lock);
+        unit = _next_unit < _unit_count ? &_units[_next_unit++] : NULL;
+        pthread_mutex_unlock(&_unit_lock);
+        if (!unit)
+            return NULL;
+
+        out = open_memstream(&unit->out, &unit->out_len);
+        err = open_memstream(&unit->err, &unit->err_len);
+        assert(out && err);
+        unit->ok = compile(unit->filename, out, err);
+        fclose(out);
+        fclose(err);
+    }
+}
+
+/* Compile the files on a pool of jobs threads, then print each unit's
+ * output and diagnostics in command line order. */
+static bool compile_batch(string_t *filenames, int count, int jobs)
+{
+    pthread_t *threads;
+    double start = now();
+    bool ok = true;
+    int i;
+
+    _units = checked_malloc(count * sizeof(*_units));
+    for (i = 0; i < count; i++)
+    {
+        _units[i].filename = filenames[i];
+        _units[i].out = _units[i].err = NULL;
+        _units[i].ok = false;
+    }
+    _unit_count = count;
+    _next_unit = 0;
+
+    if (jobs > count)
+        jobs = count;
+    threads = checked_malloc(jobs * sizeof(*threads));
+    for (i = 0; i < jobs; i++)
+        if (pthread_create(&threads[i], NULL, compile_units, NULL) != 0)
+        {
+            fprintf(stderr, "cannot create thread\n");
+            exit(1);
+        }
+    for (i = 0; i < jobs; i++)
+        pthread_join(threads[i], NULL);
+
+    for (i = 0; i < count; i++)
+    {
+        unit_t unit = &_units[i];
+        fwrite(unit->err, 1, unit->err_len, stderr);
+        fwrite(unit->out, 1, unit->out_len, stdout);
+        free(unit->err);
+        free(unit->out);
+        if (!unit->ok)
+            ok = false;
+    }
+    if (_stats)
+    {
+        double secs = now() - start;
+        fprintf(stderr, "batch: %d files, %d jobs, %.3fs (%.1f files/s)\n",
+                count, jobs, secs, secs > 0 ? count / secs : 0.0);
     }
 
-    esc_find_escape(prog);
-    // pp_expr(stdout, 0, prog);
-    sem_trans_prog(prog);
+    free(threads);
+    free(_units);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    string_t *filenames = checked_malloc(argc * sizeof(*filenames));
+    bool lex_only_mode = false;
+    string_t serve_path = NULL, connect_path = NULL;
+    int count = 0, jobs = 0;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--no-mmap") == 0)
+            lex_mmap = false;
+        else if (strcmp(argv[i], "--lex-only") == 0)
+            lex_only_mode = true;
+        else if (strcmp(argv[i], "--parse-only") == 0)
+            _parse_only = true;
+        else if (strcmp(argv[i], "--check-only") == 0)
+            _check_only = true;
+        else if (strcmp(argv[i], "--display") == 0)
+            tr_display = true;
+        else if (strcmp(argv[i], "--lift") == 0)
+            lift_enabled = true;
+        else if (strcmp(argv[i], "--no-output") == 0)
+            _no_output = true;
+        else if (strcmp(argv[i], "--stats") == 0)
+            _stats = true;
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+            serve_path = argv[++i];
+        else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc)
+            connect_path = argv[++i];
+        else if (strcmp(argv[i], "--body-jobs") == 0 && i + 1 < argc)
+        {
+            sem_jobs = atoi(argv[++i]);
+            if (sem_jobs <= 0)
+                usage(argv[0]);
+        }
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            jobs = atoi(argv[++i]);
+            if (jobs <= 0)
+                usage(argv[0]);
+        }
+        else if (argv[i][0] == '-')
+            usage(argv[0]);
+        else
+            filenames[count++] = argv[i];
+    }
+    if (serve_path)
+    {
+        if (count || connect_path || lex_only_mode)
+            usage(argv[0]);
+        return srv_serve(serve_path, jobs ? jobs : 1, _check_only);
+    }
+    if (count == 0 || (lex_only_mode && (count > 1 || jobs)))
+        usage(argv[0]);
+    if (connect_path)
+    {
+        if (lex_only_mode || jobs)
+            usage(argv[0]);
+        return srv_request(connect_path, filenames, count, _stats) ? 0 : 1;
+    }
+
+    if (lex_only_mode)
+    {
+        lex_only(filenames[0]);
+        return em_any_errors ? 1 : 0;
+    }
 
-    return 0;
+    if (count == 1 && !jobs)
+        return compile(filenames[0], stdout, stderr) ? 0 : 1;
+    return compile_batch(filenames, count, jobs ? jobs : 1) ? 0 : 1;
 }
@@ -8,6 +8,12 @@
 
 extern int yydebug;
 
-ast_expr_t parse(string_t filename);
+ast_expr_t parse(string_t filename, ast_store_t tree);
+/* Parse len bytes at buf; name only labels the diagnostics. */
+ast_expr_t parse_buffer(string_t name, const char *buf, int len, ast_store_t tree);
+/* Parse the len bytes of buf from position start on as a program of their
+ * own, giving the tree the positions of the whole buffer.  The caller
+ * resets the diagnostics for buf. */
+ast_expr_t parse_fragment(const char *buf, int start, int len, ast_store_t tree);
 
 #endif
@@ -1,14 +1,19 @@
+%code requires {
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void *yyscan_t;
+#endif
+}
+
 %{
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "ast.h"
 #include "errmsg.h"
+#include "lexer.h"
 #include "symbol.h"
 #include "utils.h"
-
-int yylex(void);
-void yyerror(char *msg);
 %}
 
 %union {
@@ -16,55 +21,63 @@ void yyerror(char *msg);
     int num;
     string_t str;
     list_t list;
+    list_queue_t queue;
     symbol_t sym;
     ast_decl_t decl;
     ast_expr_t expr;
     ast_type_t type;
     ast_var_t var;
+    /* The outermost and innermost variables of a partial lvalue. */
+    struct { ast_var_t top, bottom; } vars;
     ast_func_t func;
 }
 
 %{
+/* The parser's stacks grow on the heap, so let them grow as deep as the
+ * program nests. */
+#define YYMAXDEPTH 10000000
+
+void yyerror(yyscan_t scanner, ast_expr_t *program, char *msg);
+
 static void print_token_value(FILE *fp, int type, YYSTYPE value);
 #define YYPRINT(fp, type, value) print_token_value(fp, type, value)
 
+#define LIST_EMPTY(target) ((target).head = (target).tail = NULL)
+#define LIST_START(target, elem) \
+    ((target).head = (target).tail = ast_list((elem), NULL))
 #define LIST_ACTION(target, prev, elem) \
     do \
     { \
-        list_t p, e = list((elem), NULL); \
-        (target) = p = (prev); \
-        if (p) \
-        { \
-            while (p->next) \
-                p = p->next; \
-            p->next = e; \
-        } \
-        else \
-            (target) = e; \
+        (target) = (prev); \
+        list_enqueue(&(target), ast_list((elem), NULL)); \
     } \
     while (false)
+/* The lvalue's tail is reduced from the right, so each element to its
+ * left becomes the base of the innermost variable so far. */
 #define LVALUE_ACTION(target, prev, elem) \
     do \
     { \
-        ast_var_t p, var = (elem); \
-        (target) = p = (prev); \
-        if (p) \
+        ast_var_t var = (elem); \
+        if ((prev).top) \
         { \
-            while (p->u.field.var) \
-                p = p->u.field.var; \
-            p->u.field.var = var; \
+            ast_set_var_base((prev).bottom, var); \
+            (target).top = (prev).top; \
         } \
         else \
-            (target) = var; \
+            (target).top = var; \
+        (target).bottom = var; \
     } \
     while (false)
-
-static ast_expr_t _program;
 %}
 
+%define api.pure full
+%lex-param {yyscan_t scanner}
+%parse-param {yyscan_t scanner} {ast_expr_t *program}
+
 %debug
 
-%token <str> TK_ID TK_STRING
+%token <sym> TK_ID
+%token <str> TK_STRING
 %token <num> TK_INT
 
 %token <pos>
@@ -87,9 +100,11 @@ static ast_expr_t _program;
 %type <decl> decl var_decl
 %type <expr> program expr
 %type <type> type
-%type <var> lvalue lvalue_
-%type <list> expr_seq arg_seq efield_seq decls funcs_decl types_decl fields
-%type <list> field_seq
+%type <var> lvalue
+%type <vars> lvalue_
+%type <list> fields
+%type <queue> expr_seq arg_seq efield_seq decls funcs_decl types_decl
+%type <queue> field_seq
 %type <func> func_decl
 %type <sym> id
 
@@ -99,15 +114,15 @@ static ast_expr_t _program;
 
 program:
     expr
-    { _program = $1; }
+    { *program = $1; }
 
 expr:
     lvalue
-    { $$ = ast_var_expr($1->pos, $1); }
+    { $$ = ast_var_expr(ast_var_pos($1), $1); }
 |   TK_NIL
     { $$ = ast_nil_expr($1); }
 |   expr expr_seq
-    { $$ = ast_seq_expr($1->pos, list($1, $2)); }
+    { $$ = ast_seq_expr(ast_pos($1), ast_list(AST_EXPR_DATA($1), $2.head)); }
 |   TK_LPARAN TK_RPARAN
     { $$ = ast_seq_expr($1, NULL); }
 |   TK_LPARAN expr TK_RPARAN
@@ -121,7 +136,7 @@ expr:
 |   id TK_LPARAN TK_RPARAN
     { $$ = ast_call_expr($2, $1, NULL); }
 |   id TK_LPARAN expr arg_seq TK_RPARAN
-    { $$ = ast_call_expr($2, $1, list($3, $4)); }
+    { $$ = ast_call_expr($2, $1, ast_list(AST_EXPR_DATA($3), $4.head)); }
 |   expr TK_PLUS expr
     { $$ = ast_op_expr($2, $1, AST_PLUS, $3); }
 |   expr TK_MINUS expr
@@ -149,13 +164,16 @@ expr:
 |   id TK_LBRACE TK_RBRACE
     { $$ = ast_record_expr($2, $1, NULL); }
 |   id TK_LBRACE id TK_EQ expr efield_seq TK_RBRACE
-    { $$ = ast_record_expr($2, $1, list(ast_efield($4, $3, $5), $6)); }
+    {
+        $$ = ast_record_expr($2, $1,
+                             ast_list(ast_efield($4, $3, $5), $6.head));
+    }
 |   id TK_LBRACK expr TK_RBRACK TK_OF expr
     { $$ = ast_array_expr($2, $1, $3, $6); }
 |   lvalue TK_ASSIGN expr
     { $$ = ast_assign_expr($2, $1, $3); }
 |   TK_IF expr TK_THEN expr
-    { $$ = ast_if_expr($1, $2, $4, NULL); }
+    { $$ = ast_if_expr($1, $2, $4, 0); }
 |   TK_IF expr TK_THEN expr TK_ELSE expr
     { $$ = ast_if_expr($1, $2, $4, $6); }
 |   TK_WHILE expr TK_DO expr
@@ -165,24 +183,24 @@ expr:
 |   TK_BREAK
     { $$ = ast_break_expr($1); }
 |   TK_LET decls TK_IN expr TK_END
-    { $$ = ast_let_expr($1, $2, $4); }
+    { $$ = ast_let_expr($1, $2.head, $4); }
 
 decls:
     /* empty */
-    { $$ = NULL; }
+    { LIST_EMPTY($$); }
 |   decls decl
     { LIST_ACTION($$, $1, $2); }
 
 decl:
     types_decl
-    { $$ = ast_types_decl(((ast_type_t) $1->data)->pos, $1); }
+    { $$ = ast_types_decl(((ast_type_t) $1.head->data)->pos, $1.head); }
 |   var_decl
 |   funcs_decl
-    { $$ = ast_funcs_decl(((ast_func_t) $1->data)->pos, $1); }
+    { $$ = ast_funcs_decl(((ast_func_t) $1.head->data)->pos, $1.head); }
 
 types_decl:
     TK_TYPE id TK_EQ type
-    { $$ = list(ast_nametype($2, $4), NULL); }
+    { LIST_START($$, ast_nametype($2, $4)); }
 |   types_decl TK_TYPE id TK_EQ type
     { LIST_ACTION($$, $1, ast_nametype($3, $5)); }
 
@@ -198,7 +216,7 @@ fields:
     /* empty */
     { $$ = NULL; }
 |   id TK_COLON id field_seq
-    { $$ = list(ast_field($1, $3), $4); }
+    { $$ = ast_list(ast_field($1, $3), $4.head); }
 
 var_decl:
     TK_VAR id TK_ASSIGN expr
@@ -208,59 +226,71 @@ var_decl:
 
 funcs_decl:
     func_decl
-    { $$ = list($1, NULL); }
+    { LIST_START($$, $1); }
 |   funcs_decl func_decl
     { LIST_ACTION($$, $1, $2); }
 
 func_decl:
     TK_FUNCTION id TK_LPARAN fields TK_RPARAN TK_EQ expr
-    { $$ = ast_func($1, $2, $4, NULL, $7); }
+    {
+        $$ = ast_func($1, $2, $4, NULL, $7);
+        $$->body_start = $6 + 1;
+        $$->body_end = em_tok_pos;
+    }
 |   TK_FUNCTION id TK_LPARAN fields TK_RPARAN TK_COLON id TK_EQ expr
-    { $$ = ast_func($1, $2, $4, $7, $9); }
+    {
+        $$ = ast_func($1, $2, $4, $7, $9);
+        $$->body_start = $8 + 1;
+        $$->body_end = em_tok_pos;
+    }
 
 expr_seq:
     TK_SEMICOLON expr
-    { $$ = list($2, NULL); }
+    { LIST_START($$, AST_EXPR_DATA($2)); }
 |   expr_seq TK_SEMICOLON expr
-    { LIST_ACTION($$, $1, $3); }
+    { LIST_ACTION($$, $1, AST_EXPR_DATA($3)); }
 
 arg_seq:
     /* empty */
-    { $$ = NULL; }
+    { LIST_EMPTY($$); }
 |   arg_seq TK_COMMA expr
-    { LIST_ACTION($$, $1, $3); }
+    { LIST_ACTION($$, $1, AST_EXPR_DATA($3)); }
 
 efield_seq:
     /* empty */
-    { $$ = NULL; }
+    { LIST_EMPTY($$); }
 |   efield_seq TK_COMMA id TK_EQ expr
     { LIST_ACTION($$, $1, ast_efield($4, $3, $5)); }
 
 field_seq:
     /* empty */
-    { $$ = NULL; }
+    { LIST_EMPTY($$); }
 |   field_seq TK_COMMA id TK_COLON id
     { LIST_ACTION($$, $1, ast_field($3, $5)); }
 
 lvalue:
     id lvalue_
-    { LVALUE_ACTION($$, $2, ast_simple_var(em_tok_pos, $1)); }
+    {
+        ast_var_t var = ast_simple_var(em_tok_pos, $1);
+        if ($2.top)
+            ast_set_var_base($2.bottom, var);
+        $$ = $2.top ? $2.top : var;
+    }
 
 lvalue_:
     /* empty */
-    { $$ = NULL; }
+    { $$.top = $$.bottom = 0; }
 |   TK_DOT id lvalue_
-    { LVALUE_ACTION($$, $3, ast_field_var($1, NULL, $2)); }
+    { LVALUE_ACTION($$, $3, ast_field_var($1, 0, $2)); }
 |   TK_LBRACK expr TK_RBRACK lvalue_
-    { LVALUE_ACTION($$, $4, ast_sub_var($1, NULL, $2)); }
+    { LVALUE_ACTION($$, $4, ast_sub_var($1, 0, $2)); }
 
 id:
     TK_ID
-    { $$ = symbol($1); }
 
 %%
 
-void yyerror(char *msg)
+void yyerror(yyscan_t scanner, ast_expr_t *program, char *msg)
 {
     em_error(em_tok_pos, "%s", msg);
 }
@@ -270,6 +300,8 @@ static void print_token_value(FILE *fp, int type, YYSTYPE value)
     switch (type)
     {
         case TK_ID:
+            fprintf(fp, "%s", sym_name(value.sym));
+            break;
         case TK_STRING:
             fprintf(fp, "%s", value.str);
             break;
@@ -279,11 +311,46 @@ static void print_token_value(FILE *fp, int type, YYSTYPE value)
     }
 }
 
-ast_expr_t parse(string_t filename)
+static ast_expr_t run_parser(yyscan_t scanner)
+{
+    ast_expr_t prog = 0;
+
+    if (yyparse(scanner, &prog) != 0)
+        prog = 0;
+    lex_close(scanner);
+    return prog;
+}
+
+ast_expr_t parse(string_t filename, ast_store_t tree)
 {
+    yyscan_t scanner;
+
     em_reset(filename);
-    if (yyparse() == 0)
-        return _program;
-    else
-        return NULL;
+    ast_set_store(tree);
+    if (!lex_open(&scanner, filename))
+    {
+        em_error(0, "cannot open file: %s", filename);
+        return 0;
+    }
+    return run_parser(scanner);
+}
+
+ast_expr_t parse_buffer(string_t name, const char *buf, int len, ast_store_t tree)
+{
+    yyscan_t scanner;
+
+    em_reset_buffer(name, buf, len);
+    ast_set_store(tree);
+    lex_open_buffer(&scanner, buf, len);
+    return run_parser(scanner);
+}
+
+ast_expr_t parse_fragment(const char *buf, int start, int len, ast_store_t tree)
+{
+    yyscan_t scanner;
+
+    ast_set_store(tree);
+    lex_open_buffer(&scanner, buf + start - 1, len);
+    lex_set_pos(scanner, start);
+    return run_parser(scanner);
 }
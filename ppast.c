@@ -4,10 +4,64 @@
 #include "symbol.h"
 #include "utils.h"
 
-static void pp_efield(FILE *fp, int d, ast_efield_t efield);
-static void pp_field(FILE *fp, int d, ast_field_t field);
-static void pp_func(FILE *fp, int d, ast_func_t func);
-static void pp_nametype(FILE *fp, int d, ast_nametype_t nametype);
+/* The tree nests as deeply as the program likes, so it is not printed by
+ * recursion on the thread's stack.  Printing a node prints its first line
+ * and pushes what is left of it, its children and closing lines, on a
+ * stack of items of its own, the last to print first. */
+typedef struct pp_item_s pp_item_t;
+typedef void (*pp_func_t)(FILE *, int, void *);
+struct pp_item_s
+{
+    enum { PP_EXPR, PP_VAR, PP_DECL, PP_TYPE, PP_LIST, PP_TEXT } kind;
+    int d;
+    union
+    {
+        ast_expr_t expr;
+        ast_var_t var;
+        ast_decl_t decl;
+        ast_type_t type;
+        struct { list_t list; pp_func_t func; } list;
+        string_t text;
+    } u;
+};
+
+static THREAD_LOCAL pp_item_t *_items;
+static THREAD_LOCAL int _item_count, _item_cap;
+
+static void print_efield(FILE *fp, int d, ast_efield_t efield);
+static void print_field(FILE *fp, int d, ast_field_t field);
+static void print_func(FILE *fp, int d, ast_func_t func);
+static void print_nametype(FILE *fp, int d, ast_nametype_t nametype);
+
+static pp_item_t *push(int kind, int d)
+{
+    if (_item_count == _item_cap)
+        _items = grow_array(_items, _item_count, &_item_cap, sizeof(*_items));
+    _items[_item_count].kind = kind;
+    _items[_item_count].d = d;
+    return &_items[_item_count++];
+}
+
+static void push_expr(int d, ast_expr_t expr)
+{
+    push(PP_EXPR, d)->u.expr = expr;
+}
+
+static void push_var(int d, ast_var_t var)
+{
+    push(PP_VAR, d)->u.var = var;
+}
+
+/* A line of its own at indent d. */
+static void push_text(int d, string_t text)
+{
+    push(PP_TEXT, d)->u.text = text;
+}
+
+static void push_close(int d)
+{
+    push_text(d, ")");
+}
 
 static void indent(FILE *fp, int d)
 {
@@ -25,27 +79,39 @@ static void pp_op(FILE *fp, ast_binop_t op)
     fprintf(fp, "%s\n", _ops[op]);
 }
 
-typedef void (*pp_func_t)(FILE *, int, void *);
-
 static void pp_list(FILE *fp, int d, list_t list, string_t name, pp_func_t func)
 {
+    pp_item_t *item;
+
     fprintf(fp, "%s(\n", name);
-    for (; list; list = list->next)
-        func(fp, d, list->data);
-    indent(fp, d-1);
-    fprintf(fp, ")\n");
+    push_close(d-1);
+    if (!list)
+        return;
+    item = push(PP_LIST, d);
+    item->u.list.list = list;
+    item->u.list.func = func;
 }
 
-void pp_decl(FILE *fp, int d, ast_decl_t decl)
+static void pp_kids(FILE *fp, int d, uint32_t first, int count, string_t name)
+{
+    int i;
+
+    fprintf(fp, "%s(\n", name);
+    push_close(d-1);
+    for (i = count - 1; i >= 0; i--)
+        push_expr(d, ast_kid(first, i));
+}
+
+static void print_decl(FILE *fp, int d, ast_decl_t decl)
 {
     indent(fp, d);
     switch (decl->kind)
     {
         case AST_FUNCS_DECL:
-            pp_list(fp, d+1, decl->u.funcs, "funcs_decl", (pp_func_t) pp_func);
+            pp_list(fp, d+1, decl->u.funcs, "funcs_decl", (pp_func_t) print_func);
             break;
         case AST_TYPES_DECL:
-            pp_list(fp, d+1, decl->u.types, "types_decl", (pp_func_t) pp_nametype);
+            pp_list(fp, d+1, decl->u.types, "types_decl", (pp_func_t) print_nametype);
             break;
         case AST_VAR_DECL:
             fprintf(fp, "var_decl(%s\n", sym_name(decl->u.var.var));
@@ -54,96 +120,88 @@ void pp_decl(FILE *fp, int d, ast_decl_t decl)
                 indent(fp, d+1);
                 fprintf(fp, "%s\n", sym_name(decl->u.var.type));
             }
-            pp_expr(fp, d+1, decl->u.var.init);
-            indent(fp, d+1);
-            fprintf(fp, "%s\n", decl->u.var.escape ? "TRUE" : "FALSE");
-            indent(fp, d);
-            fprintf(fp, ")\n");
+            push_close(d);
+            push_text(d+1, decl->u.var.escape ? "TRUE" : "FALSE");
+            push_expr(d+1, decl->u.var.init);
             break;
         default:
             assert(0);
     }
 }
 
-void pp_expr(FILE *fp, int d, ast_expr_t expr)
+static void print_expr(FILE *fp, int d, ast_expr_t expr)
 {
     indent(fp, d);
-    switch (expr->kind) {
+    switch (ast_kind(expr)) {
         case AST_NIL_EXPR:
             fprintf(fp, "nil_expr()\n");
             break;
         case AST_VAR_EXPR:
             fprintf(fp, "var_expr(\n");
-            pp_var(fp, d+1, expr->u.var);
-            indent(fp, d);
-            fprintf(fp, ")\n");
+            push_close(d);
+            push_var(d+1, ast_var(expr));
             break;
         case AST_NUM_EXPR:
-            fprintf(fp, "int_expr(%d)\n", expr->u.num);
+            fprintf(fp, "int_expr(%d)\n", ast_num(expr));
             break;
         case AST_STRING_EXPR:
-            fprintf(fp, "string_expr(%s)\n", expr->u.str);
+            fprintf(fp, "string_expr(%s)\n", ast_str(expr));
             break;
         case AST_CALL_EXPR:
-            fprintf(fp, "call_expr(%s\n", sym_name(expr->u.call.func));
+            fprintf(fp, "call_expr(%s\n", sym_name(ast_call(expr)->func));
             indent(fp, d+1);
-            pp_list(fp, d+2, expr->u.call.args, "call_args", (pp_func_t) pp_expr);
-            indent(fp, d);
-            fprintf(fp, ")\n");
+            push_close(d);
+            pp_kids(fp, d+2, ast_call(expr)->first, ast_call(expr)->count,
+                    "call_args");
             break;
         case AST_OP_EXPR:
             fprintf(fp, "op_expr(\n");
             indent(fp, d+1);
-            pp_op(fp, expr->u.op.op);
-            pp_expr(fp, d+1, expr->u.op.left);
-            pp_expr(fp, d+1, expr->u.op.right);
-            indent(fp, d);
-            fprintf(fp, ")\n");
+            pp_op(fp, ast_op(expr)->op);
+            push_close(d);
+            push_expr(d+1, ast_op(expr)->right);
+            push_expr(d+1, ast_op(expr)->left);
             break;
         case AST_RECORD_EXPR:
-            fprintf(fp, "record_expr(%s\n", sym_name(expr->u.record.type));
+            fprintf(fp, "record_expr(%s\n", sym_name(ast_record(expr)->type));
             indent(fp, d+1);
-            pp_list(fp, d+2, expr->u.record.efields, "efields", (pp_func_t) pp_efield);
-            indent(fp, d);
-            fprintf(fp, ")\n");
+            push_close(d);
+            pp_list(fp, d+2, ast_record(expr)->efields, "efields", (pp_func_t) print_efield);
             break;
         case AST_ARRAY_EXPR:
-            fprintf(fp, "array_expr(%s\n", sym_name(expr->u.array.type));
-            pp_expr(fp, d+1, expr->u.array.size);
-            pp_expr(fp, d+1, expr->u.array.init);
-            indent(fp, d);
-            fprintf(fp, ")\n");
+            fprintf(fp, "array_expr(%s\n", sym_name(ast_array(expr)->type));
+            push_close(d);
+            push_expr(d+1, ast_array(expr)->init);
+            push_expr(d+1, ast_array(expr)->size);
             break;
         case AST_SEQ_EXPR:
-            pp_list(fp, d+1, expr->u.seq, "seq_exp", (pp_func_t) pp_expr);
+            pp_kids(fp, d+1, ast_seq(expr)->first, ast_seq(expr)->count,
+                    "seq_exp");
             break;
         case AST_IF_EXPR:
             fprintf(fp, "if_expr(\n");
-            pp_expr(fp, d+1, expr->u.if_.cond);
-            pp_expr(fp, d+1, expr->u.if_.then);
-            if (expr->u.if_.else_)
+            push_close(d);
+            if (ast_if(expr)->else_)
             {
-                pp_expr(fp, d+1, expr->u.if_.else_);
+                push_expr(d+1, ast_if(expr)->else_);
             }
-            indent(fp, d);
-            fprintf(fp, ")\n");
+            push_expr(d+1, ast_if(expr)->then);
+            push_expr(d+1, ast_if(expr)->cond);
             break;
         case AST_WHILE_EXPR:
             fprintf(fp, "while_expr(\n");
-            pp_expr(fp, d+1, expr->u.while_.cond);
-            pp_expr(fp, d+1, expr->u.while_.body);
-            indent(fp, d);
-            fprintf(fp, ")\n");
+            push_close(d);
+            push_expr(d+1, ast_while(expr)->body);
+            push_expr(d+1, ast_while(expr)->cond);
             break;
         case AST_FOR_EXPR:
-            fprintf(fp, "for_expr(%s,\n", sym_name(expr->u.for_.var));
+            fprintf(fp, "for_expr(%s,\n", sym_name(ast_for(expr)->var));
             indent(fp, d+1);
-            fprintf(fp, "%s\n", expr->u.for_.escape ? "TRUE" : "FALSE");
-            pp_expr(fp, d+1, expr->u.for_.lo);
-            pp_expr(fp, d+1, expr->u.for_.hi);
-            pp_expr(fp, d+1, expr->u.for_.body);
-            indent(fp, d);
-            fprintf(fp, ")\n");
+            fprintf(fp, "%s\n", ast_for(expr)->escape ? "TRUE" : "FALSE");
+            push_close(d);
+            push_expr(d+1, ast_for(expr)->body);
+            push_expr(d+1, ast_for(expr)->hi);
+            push_expr(d+1, ast_for(expr)->lo);
             break;
         case AST_BREAK_EXPR:
             fprintf(fp, "break_expr()\n");
@@ -151,24 +209,22 @@ void pp_expr(FILE *fp, int d, ast_expr_t expr)
         case AST_LET_EXPR:
             fprintf(fp, "let_expr(\n");
             indent(fp, d+1);
-            pp_list(fp, d+2, expr->u.let.decls, "decls", (pp_func_t) pp_decl);
-            pp_expr(fp, d+1, expr->u.let.body);
-            indent(fp, d);
-            fprintf(fp, ")\n");
+            push_close(d);
+            push_expr(d+1, ast_let(expr)->body);
+            pp_list(fp, d+2, ast_let(expr)->decls, "decls", (pp_func_t) print_decl);
             break;
         case AST_ASSIGN_EXPR:
             fprintf(fp, "assign_expr(\n");
-            pp_var(fp, d+1, expr->u.assign.var);
-            pp_expr(fp, d+1, expr->u.assign.expr);
-            indent(fp, d);
-            fprintf(fp, ")\n");
+            push_close(d);
+            push_expr(d+1, ast_assign(expr)->expr);
+            push_var(d+1, ast_assign(expr)->var);
             break;
         default:
             assert(0);
     }
 }
 
-void pp_type(FILE *fp, int d, ast_type_t type)
+static void print_type(FILE *fp, int d, ast_type_t type)
 {
     indent(fp, d);
     switch (type->kind)
@@ -177,7 +233,7 @@ void pp_type(FILE *fp, int d, ast_type_t type)
             fprintf(fp, "name_type(%s)\n", sym_name(type->u.name));
             break;
         case AST_RECORD_TYPE:
-            pp_list(fp, d+1, type->u.record, "record_type", (pp_func_t) pp_field);
+            pp_list(fp, d+1, type->u.record, "record_type", (pp_func_t) print_field);
             break;
         case AST_ARRAY_TYPE:
             fprintf(fp, "array_type(%s)\n", sym_name(type->u.array));
@@ -187,49 +243,45 @@ void pp_type(FILE *fp, int d, ast_type_t type)
     }
 }
 
-void pp_var(FILE *fp, int d, ast_var_t var)
+static void print_var(FILE *fp, int d, ast_var_t var)
 {
     indent(fp, d);
-    switch (var->kind)
+    switch (ast_var_kind(var))
     {
         case AST_SIMPLE_VAR:
-            fprintf(fp, "simple_var(%s)\n", sym_name(var->u.simple));
+            fprintf(fp, "simple_var(%s)\n", sym_name(ast_var_name(var)));
             break;
         case AST_FIELD_VAR:
             fprintf(fp, "field_var(\n");
-            pp_var(fp, d+1, var->u.field.var);
-            indent(fp, d+1);
-            fprintf(fp, "%s\n", sym_name(var->u.field.field));
-            indent(fp, d);
-            fprintf(fp, ")\n");
+            push_close(d);
+            push_text(d+1, sym_name(ast_var_name(var)));
+            push_var(d+1, ast_var_base(var));
             break;
         case AST_SUB_VAR:
             fprintf(fp, "sub_var(\n");
-            pp_var(fp, d+1, var->u.sub.var);
-            pp_expr(fp, d+1, var->u.sub.sub);
-            indent(fp, d);
-            fprintf(fp, ")\n");
+            push_close(d);
+            push_expr(d+1, ast_var_sub(var));
+            push_var(d+1, ast_var_base(var));
             break;
         default:
             assert(0);
     }
 }
 
-static void pp_efield(FILE *fp, int d, ast_efield_t efield)
+static void print_efield(FILE *fp, int d, ast_efield_t efield)
 {
     indent(fp, d);
     if (efield)
     {
         fprintf(fp, "efield(%s\n", sym_name(efield->name));
-        pp_expr(fp, d+1, efield->expr);
-        indent(fp, d);
-        fprintf(fp, ")\n");
+        push_close(d);
+        push_expr(d+1, efield->expr);
     }
     else
         fprintf(fp, "efield()\n");
 }
 
-static void pp_field(FILE *fp, int d, ast_field_t field)
+static void print_field(FILE *fp, int d, ast_field_t field)
 {
     indent(fp, d);
     fprintf(fp, "field(%s\n", sym_name(field->name));
@@ -241,27 +293,92 @@ static void pp_field(FILE *fp, int d, ast_field_t field)
     fprintf(fp, ")\n");
 }
 
-static void pp_func(FILE *fp, int d, ast_func_t func)
+static void print_func(FILE *fp, int d, ast_func_t func)
 {
     indent(fp, d);
     fprintf(fp, "func(%s\n", sym_name(func->name));
     indent(fp, d+1);
-    pp_list(fp, d+2, func->params, "params", (pp_func_t) pp_field);
+    push_close(d);
+    push_expr(d+1, func->body);
     if (func->result)
-    {
-        indent(fp, d+1);
-        fprintf(fp, "%s\n", sym_name(func->result));
-    }
-    pp_expr(fp, d+1, func->body);
-    indent(fp, d);
-    fprintf(fp, ")\n");
+        push_text(d+1, sym_name(func->result));
+    pp_list(fp, d+2, func->params, "params", (pp_func_t) print_field);
 }
 
-static void pp_nametype(FILE *fp, int d, ast_nametype_t nametype)
+static void print_nametype(FILE *fp, int d, ast_nametype_t nametype)
 {
     indent(fp, d);
     fprintf(fp, "nametype(%s\n", sym_name(nametype->name));
-    pp_type(fp, d+1, nametype->type);
-    indent(fp, d);
-    fprintf(fp, ")\n");
+    push_close(d);
+    push(PP_TYPE, d+1)->u.type = nametype->type;
+}
+
+/* Print the items above base until there are none. */
+static void run(FILE *fp, int base)
+{
+    while (_item_count > base)
+    {
+        pp_item_t item = _items[--_item_count];
+
+        switch (item.kind)
+        {
+            case PP_EXPR:
+                print_expr(fp, item.d, item.u.expr);
+                break;
+            case PP_VAR:
+                print_var(fp, item.d, item.u.var);
+                break;
+            case PP_DECL:
+                print_decl(fp, item.d, item.u.decl);
+                break;
+            case PP_TYPE:
+                print_type(fp, item.d, item.u.type);
+                break;
+            case PP_LIST:
+                if (item.u.list.list->next)
+                {
+                    pp_item_t *next = push(PP_LIST, item.d);
+                    next->u.list.list = item.u.list.list->next;
+                    next->u.list.func = item.u.list.func;
+                }
+                item.u.list.func(fp, item.d, item.u.list.list->data);
+                break;
+            case PP_TEXT:
+                indent(fp, item.d);
+                fprintf(fp, "%s\n", item.u.text);
+                break;
+        }
+    }
+}
+
+void pp_decl(FILE *fp, int d, ast_decl_t decl)
+{
+    int base = _item_count;
+
+    push(PP_DECL, d)->u.decl = decl;
+    run(fp, base);
+}
+
+void pp_expr(FILE *fp, int d, ast_expr_t expr)
+{
+    int base = _item_count;
+
+    push_expr(d, expr);
+    run(fp, base);
+}
+
+void pp_type(FILE *fp, int d, ast_type_t type)
+{
+    int base = _item_count;
+
+    push(PP_TYPE, d)->u.type = type;
+    run(fp, base);
+}
+
+void pp_var(FILE *fp, int d, ast_var_t var)
+{
+    int base = _item_count;
+
+    push_var(d, var);
+    run(fp, base);
 }
@@ -5,8 +5,6 @@
 #include "ir.h"
 #include "temp.h"
 
-static void pp_expr(FILE *out, int d, ir_expr_t expr);
-
 static void indent(FILE *out, int d)
 {
     int i;
@@ -43,24 +41,67 @@ static char const* relops[] = {
     "UGE",
 };
 
+/* Trees are as deep as the program's expressions, so they are not printed
+ * by recursion on the thread's stack.  Printing a node prints its first
+ * line and pushes what is left of it, its children and closing line, on
+ * a stack of items of its own, the last to print first. */
+typedef struct pp_item_s pp_item_t;
+struct pp_item_s
+{
+    enum { PP_STMT, PP_EXPR, PP_STMTS, PP_EXPRS, PP_CLOSE, PP_LABELS } kind;
+    int d;
+    union
+    {
+        ir_stmt_t stmt;
+        ir_expr_t expr;
+        list_t list;
+    } u;
+};
+
+static THREAD_LOCAL pp_item_t *_items;
+static THREAD_LOCAL int _item_count, _item_cap;
+
+static pp_item_t *push(int kind, int d)
+{
+    if (_item_count == _item_cap)
+        _items = grow_array(_items, _item_count, &_item_cap, sizeof(*_items));
+    _items[_item_count].kind = kind;
+    _items[_item_count].d = d;
+    return &_items[_item_count++];
+}
+
+static void push_stmt(int d, ir_stmt_t stmt)
+{
+    push(PP_STMT, d)->u.stmt = stmt;
+}
+
+static void push_expr(int d, ir_expr_t expr)
+{
+    push(PP_EXPR, d)->u.expr = expr;
+}
+
+/* The rest of list, one at a time, at indent d. */
+static void push_list(int kind, int d, list_t list)
+{
+    if (list)
+        push(kind, d)->u.list = list;
+}
+
+static void push_close(int d)
+{
+    push(PP_CLOSE, d);
+}
+
 static void pp_stmt(FILE *out, int d, ir_stmt_t stmt)
 {
     switch (stmt->kind)
     {
         case IR_SEQ:
-        {
-            list_t p;
-
             indent(out, d);
             fprintf(out, "SEQ(\n");
-            for (p = stmt->u.seq; p; p = p->next)
-            {
-                pp_stmt(out, d + 1, p->data);
-            }
-            indent(out, d);
-            fprintf(out, ")\n");
+            push_close(d);
+            push_list(PP_STMTS, d + 1, stmt->u.seq);
             break;
-        }
 
         case IR_LABEL:
             indent(out, d);
@@ -70,37 +111,31 @@ static void pp_stmt(FILE *out, int d, ir_stmt_t stmt)
         case IR_JUMP:
             indent(out, d);
             fprintf(out, "JUMP(\n");
-            pp_expr(out, d + 1, stmt->u.jump.expr);
-            indent(out, d);
-            fprintf(out, ")\n");
+            push_close(d);
+            push_expr(d + 1, stmt->u.jump.expr);
             break;
 
         case IR_CJUMP:
             indent(out, d);
             fprintf(out, "CJUMP(%s\n", relops[stmt->u.cjump.op]);
-            pp_expr(out, d + 1, stmt->u.cjump.left);
-            pp_expr(out, d + 1, stmt->u.cjump.right);
-            indent(out, d + 1);
-            fprintf(out, "%s, %s)\n",
-                    tmp_name(stmt->u.cjump.t),
-                    tmp_name(stmt->u.cjump.f));
+            push(PP_LABELS, d + 1)->u.stmt = stmt;
+            push_expr(d + 1, stmt->u.cjump.right);
+            push_expr(d + 1, stmt->u.cjump.left);
             break;
 
         case IR_MOVE:
             indent(out, d);
             fprintf(out, "MOVE(\n");
-            pp_expr(out, d + 1, stmt->u.move.dst);
-            pp_expr(out, d + 1, stmt->u.move.src);
-            indent(out, d);
-            fprintf(out, ")\n");
+            push_close(d);
+            push_expr(d + 1, stmt->u.move.src);
+            push_expr(d + 1, stmt->u.move.dst);
             break;
 
         case IR_EXPR:
             indent(out, d);
             fprintf(out, "EXPR(\n");
-            pp_expr(out, d + 1, stmt->u.expr);
-            indent(out, d);
-            fprintf(out, ")\n");
+            push_close(d);
+            push_expr(d + 1, stmt->u.expr);
             break;
 
         default:
@@ -108,39 +143,43 @@ static void pp_stmt(FILE *out, int d, ir_stmt_t stmt)
     }
 }
 
-void pp_expr(FILE *out, int d, ir_expr_t expr)
+static void pp_expr(FILE *out, int d, ir_expr_t expr)
 {
     switch (expr->kind)
     {
         case IR_BINOP:
             indent(out, d);
             fprintf(out, "BINOP(%s\n", binops[expr->u.binop.op]);
-            pp_expr(out, d + 1, expr->u.binop.left);
-            pp_expr(out, d + 1, expr->u.binop.right);
-            indent(out, d);
-            fprintf(out, ")\n");
+            push_close(d);
+            push_expr(d + 1, expr->u.binop.right);
+            push_expr(d + 1, expr->u.binop.left);
             break;
 
         case IR_MEM:
             indent(out, d);
             fprintf(out, "MEM(\n");
-            pp_expr(out, d + 1, expr->u.mem);
-            indent(out, d);
-            fprintf(out, ")\n");
+            push_close(d);
+            push_expr(d + 1, expr->u.mem);
             break;
 
         case IR_TMP:
+        {
+            string_t name = tmp_lookup(tmp_map(), expr->u.tmp);
+
             indent(out, d);
-            fprintf(out, "TEMP t%s\n", tmp_lookup(tmp_map(), expr->u.tmp));
+            if (name)
+                fprintf(out, "TEMP %s\n", name);
+            else
+                fprintf(out, "TEMP t%d\n", expr->u.tmp);
             break;
+        }
 
         case IR_ESEQ:
             indent(out, d);
             fprintf(out, "ESEQ(\n");
-            pp_stmt(out, d + 1, expr->u.eseq.stmt);
-            pp_expr(out, d + 1, expr->u.eseq.expr);
-            indent(out, d);
-            fprintf(out, ")\n");
+            push_close(d);
+            push_expr(d + 1, expr->u.eseq.expr);
+            push_stmt(d + 1, expr->u.eseq.stmt);
             break;
 
         case IR_NAME:
@@ -154,20 +193,12 @@ void pp_expr(FILE *out, int d, ir_expr_t expr)
             break;
 
         case IR_CALL:
-        {
-            list_t p;
-
             indent(out, d);
             fprintf(out, "CALL(\n");
-            pp_expr(out, d + 1, expr->u.call.func);
-            for (p = expr->u.call.args; p; p = p->next)
-            {
-                pp_expr(out, d + 1, p->data);
-            }
-            indent(out, d);
-            fprintf(out, ")\n");
+            push_close(d);
+            push_list(PP_EXPRS, d + 1, expr->u.call.args);
+            push_expr(d + 1, expr->u.call.func);
             break;
-        }
 
         default:
             assert(false);
@@ -176,8 +207,44 @@ void pp_expr(FILE *out, int d, ir_expr_t expr)
 
 void pp_stmts(FILE *out, list_t stmts)
 {
-    for (; stmts; stmts = stmts->next)
+    int base = _item_count;
+
+    push_list(PP_STMTS, 0, stmts);
+    while (_item_count > base)
     {
-        pp_stmt(out, 0, stmts->data);
+        pp_item_t item = _items[--_item_count];
+
+        switch (item.kind)
+        {
+            case PP_STMT:
+                pp_stmt(out, item.d, item.u.stmt);
+                break;
+
+            case PP_EXPR:
+                pp_expr(out, item.d, item.u.expr);
+                break;
+
+            case PP_STMTS:
+                push_list(PP_STMTS, item.d, item.u.list->next);
+                pp_stmt(out, item.d, item.u.list->data);
+                break;
+
+            case PP_EXPRS:
+                push_list(PP_EXPRS, item.d, item.u.list->next);
+                pp_expr(out, item.d, item.u.list->data);
+                break;
+
+            case PP_CLOSE:
+                indent(out, item.d);
+                fprintf(out, ")\n");
+                break;
+
+            case PP_LABELS:
+                indent(out, item.d);
+                fprintf(out, "%s, %s)\n",
+                        tmp_name(item.u.stmt->u.cjump.t),
+                        tmp_name(item.u.stmt->u.cjump.f));
+                break;
+        }
     }
 }
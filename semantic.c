@@ -1,4 +1,6 @@
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "env.h"
 #include "errmsg.h"
@@ -9,8 +11,17 @@
 #include "translate.h"
 #include "types.h"
 
-static table_t _venv;
-static table_t _tenv;
+static THREAD_LOCAL sym_table_t _venv;
+static THREAD_LOCAL sym_table_t _tenv;
+
+/* The names declared so far in the group being checked for redefinitions,
+ * each bound to itself within a scope of its own. */
+static THREAD_LOCAL sym_table_t _seen;
+
+/* When only checking, nothing is translated: no tr_* call is made, so no
+ * frame, temp or label is allocated, and every tr_expr_t is NULL. */
+static THREAD_LOCAL bool _check_only;
+#define TR(call) (_check_only ? NULL : (call))
 
 typedef struct expr_type_s expr_type_t;
 struct expr_type_s
@@ -27,10 +38,104 @@ static expr_type_t expr_type(tr_expr_t expr, type_t type)
     return result;
 }
 
-static tr_expr_t trans_decl(tr_level_t level, ast_decl_t decl);
-static expr_type_t trans_expr(tr_level_t level, ast_expr_t expr);
+/* Expressions and variables nest as deeply as the program likes, so they
+ * are not translated by recursion on the thread's stack.  Each one under
+ * way has a frame on a stack of its own, and its step function does the
+ * next part of its work each time it is called: it pushes the frame of a
+ * part, whose result is in _result when the step is next called, or pops
+ * its own frame and leaves its result there.  A step must not use its
+ * frame after pushing another, which may move the stack. */
+typedef struct sem_frame_s sem_frame_t;
+typedef void (*trans_step_t)(sem_frame_t *frame);
+struct sem_frame_s
+{
+    trans_step_t step;
+    int state;
+    tr_level_t level;
+    ast_expr_t expr;
+    ast_var_t var;
+    union
+    {
+        struct
+        {
+            env_entry_t entry;
+            list_t formals;
+            int i;
+            list_queue_t args;
+        } call;
+        struct
+        {
+            type_t type;
+            list_t fields;
+            list_t efields;
+            list_queue_t exprs;
+            int size;
+        } record;
+        struct
+        {
+            list_t decls;
+            list_t funcs;
+            ast_func_t func;
+            int first;
+            list_queue_t exprs;
+        } let;
+        struct
+        {
+            ast_func_t func;
+            env_entry_t entry;
+        } body;
+        struct
+        {
+            int i;
+            list_queue_t stmts;
+        } seq;
+        struct
+        {
+            expr_type_t first;
+            expr_type_t second;
+            type_t type;
+            tr_access_t access;
+        } parts;
+    } u;
+};
+
+static THREAD_LOCAL sem_frame_t *_frames;
+static THREAD_LOCAL int _frame_count, _frame_cap;
+static THREAD_LOCAL expr_type_t _result;
+
+static sem_frame_t *push_frame(trans_step_t step, tr_level_t level)
+{
+    sem_frame_t *f;
+
+    if (_frame_count == _frame_cap)
+        _frames = grow_array(_frames, _frame_count, &_frame_cap,
+                             sizeof(*_frames));
+    f = &_frames[_frame_count++];
+    f->step = step;
+    f->state = 0;
+    f->level = level;
+    return f;
+}
+
+static void finish(expr_type_t result)
+{
+    _frame_count--;
+    _result = result;
+}
+
+/* Step the frames above base until they are all done. */
+static void run(int base)
+{
+    while (_frame_count > base)
+    {
+        sem_frame_t *f = &_frames[_frame_count - 1];
+        f->step(f);
+    }
+}
+
+static void eval_expr(tr_level_t level, ast_expr_t expr);
+static void eval_var(tr_level_t level, ast_var_t var);
 static type_t trans_type(ast_type_t type);
-static expr_type_t trans_var(tr_level_t level, ast_var_t var);
 
 #if 0 /* for debug only */
 static void show_types(void *key, void *value)
@@ -91,30 +196,333 @@ static list_t formal_escape_list(list_t params)
     return q;
 }
 
-static tr_expr_t trans_funcs_decl(tr_level_t level, ast_decl_t decl)
+/* A lifted function's free variables are formals after its own. */
+static tr_level_t func_level(tr_level_t level,
+                             ast_func_t func,
+                             tmp_label_t label)
 {
-    list_t p, q;
-    expr_type_t result;
+    list_t escapes = formal_escape_list(func->params);
 
-    /* Check for function redefinitions. */
-    for (p = decl->u.funcs; p && p->next; p = p->next)
-        for (q = p->next; q; q = q->next)
+    if (!func->lifted)
+        return tr_level(level, label, escapes);
+    return tr_lifted_level(label,
+                           join_list(escapes, formal_escape_list(func->free)));
+}
+
+/* When only checking, a function body's diagnostics are kept with it and
+ * reported again instead of checking the body anew for as long as it is
+ * marked checked; whoever edits the tree clears the mark on the functions
+ * an edit can affect. */
+static void keep_diags(ast_func_t func, int first)
+{
+    list_queue_t diags = {NULL, NULL};
+    const em_diag_t *log;
+    int count;
+
+    log = em_diags(&count);
+    for (; first < count; first++)
+    {
+        string_t msg = ast_string(log[first].msg, strlen(log[first].msg));
+        list_enqueue(&diags,
+                     ast_list(ast_diag(log[first].pos - func->pos, msg),
+                              NULL));
+    }
+    func->diags = diags.head;
+    func->checked = true;
+}
+
+static void replay_diags(ast_func_t func)
+{
+    list_t p;
+
+    for (p = func->diags; p; p = p->next)
+    {
+        ast_diag_t diag = p->data;
+        em_error(func->pos + diag->pos, "%s", diag->msg);
+    }
+}
+
+/* Check and translate a function body in the scope of its parameters, and
+ * record it as a fragment of its own level. */
+static void trans_body(sem_frame_t *f)
+{
+    ast_func_t func = f->u.body.func;
+    env_entry_t entry;
+    list_t q, r, s;
+
+    if (f->state == 0)
+    {
+        entry = f->u.body.entry = sym_lookup(_venv, func->name);
+        q = func->params;
+        r = entry->u.func.formals;
+        s = TR(tr_formals(entry->u.func.level));
+        sym_begin_scope(_venv);
+        for (; q; q = q->next, r = r->next, s = s ? s->next : NULL)
         {
-            ast_func_t func = q->data;
-            if (((ast_func_t) p->data)->name == func->name)
-                em_error(func->pos,
-                         "function '%s' redefined",
-                         sym_name(func->name));
+            sym_enter(_venv,
+                      ((ast_field_t) q->data)->name,
+                      env_var_entry(s ? s->data : NULL, r->data, false));
+        }
+        assert(!q && !r);
+        /* A lifted function's free variables are its own from here on. */
+        for (q = func->free; q; q = q->next, s = s ? s->next : NULL)
+        {
+            symbol_t name = ((ast_field_t) q->data)->name;
+            env_entry_t var = sym_lookup(_venv, name);
+
+            assert(var && var->kind == ENV_VAR_ENTRY);
+            sym_enter(_venv,
+                      name,
+                      env_var_entry(s ? s->data : NULL,
+                                    var->u.var.type,
+                                    var->u.var.for_));
         }
+        f->state = 1;
+        eval_expr(entry->u.func.level, func->body);
+        return;
+    }
+
+    entry = f->u.body.entry;
+    if (!ty_match(_result.type, entry->u.func.result))
+        em_error(func->pos, "function body's type is incorrect");
+    sym_end_scope(_venv);
+    if (!_check_only)
+        tr_proc_entry_exit(entry->u.func.level, _result.expr);
+    finish(_result);
+}
+
+static void eval_body(ast_func_t func)
+{
+    push_frame(trans_body, NULL)->u.body.func = func;
+}
+
+static void run_body(ast_func_t func)
+{
+    int base = _frame_count;
+
+    eval_body(func);
+    run(base);
+}
+
+/* With sem_jobs above one, the bodies of a big enough group are checked
+ * and translated as tasks on a pool of threads, once the prototypes are
+ * in the environment.  Each pool thread copies the environment once per
+ * group, and each body, as a task, makes its temps and labels and reports
+ * its diagnostics and fragments on its own.  The bodies are then merged
+ * in the order of the group, which numbers their temps and labels, and
+ * replays their diagnostics and adds their fragments, as translating them
+ * here one after another would have. */
+#define PAR_MIN_BODIES 16
+
+int sem_jobs = 1;
+
+/* One pool serves every thread that compiles units; _pool_lock guards
+ * making it and numbering the groups it runs. */
+static pthread_mutex_t _pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pool_t _pool;
+static int _batches;
+
+/* Set on pool threads, which run the bodies of one group at a time and
+ * the groups nested in them serially; _batch is the group's number. */
+static THREAD_LOCAL bool _in_pool;
+static THREAD_LOCAL int _batch;
+/* The index in bodies->arenas of this thread's arena for the batch. */
+static THREAD_LOCAL int _arena_index;
+
+typedef struct body_task_s body_task_t;
+struct body_task_s
+{
+    ast_func_t func;
+    bool cached;
+    em_diag_t *diags;
+    int diag_count;
+    list_t strings;
+    list_t procs;
+    tmp_task_t tmp;
+};
+
+/* Each pool thread allocates the unit's nodes from an arena of its own
+ * for the batch, which the unit's arena takes over once the batch is
+ * done; with no unit arena, arenas is NULL.  The thread only holds on to
+ * its arena, and reads the tree, while it runs a task, so that none is
+ * left pointing at an arena that has been taken over. */
+struct bodies_s
+{
+    int batch;
+    ast_store_t tree;
+    sym_table_t venv;
+    sym_table_t tenv;
+    bool check_only;
+    body_task_t *tasks;
+    pthread_mutex_t lock;
+    arena_t *arenas;
+    int arena_count;
+};
+
+static void ignore_diag(void *data, int line, int column, string_t msg)
+{
+}
+
+static void trans_body_task(void *data, int i)
+{
+    struct bodies_s *bodies = data;
+    body_task_t *task = &bodies->tasks[i];
+    const em_diag_t *log;
+    int first, count, j;
+
+    if (_batch != bodies->batch)
+    {
+        if (!_in_pool)
+        {
+            _venv = sym_empty();
+            _tenv = sym_empty();
+            _seen = sym_empty();
+            em_set_handler(ignore_diag, NULL);
+            em_set_log(true);
+            _in_pool = true;
+        }
+        sym_copy(_venv, bodies->venv);
+        sym_copy(_tenv, bodies->tenv);
+        _check_only = bodies->check_only;
+        em_reset_buffer("", NULL, 0);
+        _batch = bodies->batch;
+
+        if (bodies->arenas)
+        {
+            pthread_mutex_lock(&bodies->lock);
+            _arena_index = bodies->arena_count++;
+            bodies->arenas[_arena_index] = arena_new();
+            pthread_mutex_unlock(&bodies->lock);
+        }
+    }
+    if (bodies->arenas)
+        unit_set_arena(bodies->arenas[_arena_index]);
+    ast_set_store(bodies->tree);
+
+    task->cached = _check_only && task->func->checked;
+    em_diags(&first);
+    if (!_check_only)
+    {
+        tmp_begin_task();
+        fr_reset();
+    }
+    if (task->cached)
+        replay_diags(task->func);
+    else
+        run_body(task->func);
+    if (!_check_only)
+    {
+        task->strings = fr_string_frags();
+        task->procs = fr_proc_frags();
+        task->tmp = tmp_end_task();
+    }
+
+    log = em_diags(&count);
+    task->diag_count = count - first;
+    task->diags = checked_malloc(
+        (task->diag_count ? task->diag_count : 1) * sizeof(*task->diags));
+    for (j = 0; j < task->diag_count; j++)
+    {
+        task->diags[j].pos = log[first + j].pos;
+        task->diags[j].msg = string(log[first + j].msg);
+    }
+    unit_set_arena(NULL);
+    ast_set_store(NULL);
+}
+
+static void merge_frags(list_t frags, tmp_task_t tmp)
+{
+    for (; frags; frags = frags->next)
+    {
+        fr_relocate_frag(frags->data, tmp);
+        fr_add_frag(frags->data);
+    }
+}
+
+static void trans_bodies(ast_decl_t decl, int count)
+{
+    struct bodies_s bodies;
+    arena_t unit = unit_arena();
+    list_t p;
+    int i, j;
+
+    pthread_mutex_lock(&_pool_lock);
+    if (!_pool)
+        _pool = pool_new(sem_jobs);
+    bodies.batch = ++_batches;
+    pthread_mutex_unlock(&_pool_lock);
+    bodies.tree = ast_get_store();
+    bodies.venv = _venv;
+    bodies.tenv = _tenv;
+    bodies.check_only = _check_only;
+    bodies.tasks = checked_malloc(count * sizeof(*bodies.tasks));
+    for (p = decl->u.funcs, i = 0; p; p = p->next, i++)
+        bodies.tasks[i].func = p->data;
+    pthread_mutex_init(&bodies.lock, NULL);
+    bodies.arenas = unit ? checked_malloc(sem_jobs * sizeof(arena_t)) : NULL;
+    bodies.arena_count = 0;
+    pool_run(_pool, count, trans_body_task, &bodies);
+    for (i = 0; i < bodies.arena_count; i++)
+        arena_adopt(unit, bodies.arenas[i]);
+    free(bodies.arenas);
+    pthread_mutex_destroy(&bodies.lock);
+
+    for (i = 0; i < count; i++)
+    {
+        body_task_t *task = &bodies.tasks[i];
+        int first;
+
+        em_diags(&first);
+        for (j = 0; j < task->diag_count; j++)
+        {
+            em_error(task->diags[j].pos, "%s", task->diags[j].msg);
+            free(task->diags[j].msg);
+        }
+        free(task->diags);
+        if (_check_only)
+        {
+            if (!task->cached)
+                keep_diags(task->func, first);
+            continue;
+        }
+
+        tmp_merge_task(task->tmp);
+        merge_frags(task->strings, task->tmp);
+        merge_frags(task->procs, task->tmp);
+        tmp_free_task(task->tmp);
+    }
+    free(bodies.tasks);
+}
+
+/* Check a group of functions for redefinitions and enter their prototypes
+ * into the environment, ahead of their bodies; return how many there are. */
+static int enter_funcs(tr_level_t level, ast_decl_t decl)
+{
+    list_t p;
+    int count = 0;
+
+    /* Check for function redefinitions. */
+    sym_begin_scope(_seen);
+    for (p = decl->u.funcs; p; p = p->next)
+    {
+        ast_func_t func = p->data;
+        count++;
+        if (sym_lookup(_seen, func->name))
+            em_error(func->pos,
+                     "function '%s' redefined",
+                     sym_name(func->name));
+        else
+            sym_enter(_seen, func->name, func->name);
+    }
+    sym_end_scope(_seen);
 
     /* Enter function prototypes into symbol table. */
     for (p = decl->u.funcs; p; p = p->next)
     {
         ast_func_t func = p->data;
         list_t formals = formal_type_list(func->params, decl->pos);
-        list_t escapes = formal_escape_list(func->params);
         type_t result;
-        tmp_label_t label = tmp_label();
+        tmp_label_t label = TR(tmp_label());
 
         if (func->result)
         {
@@ -126,53 +534,33 @@ static tr_expr_t trans_funcs_decl(tr_level_t level, ast_decl_t decl)
             result = ty_void();
         sym_enter(_venv,
                   func->name,
-                  env_func_entry(tr_level(level, label, escapes),
+                  env_func_entry(TR(func_level(level, func, label)),
                                  label,
                                  formals,
-                                 result));
+                                 result,
+                                 func->free));
     }
 
-    /* Translate the possibly mutually recursive functions. */
-    for (p = decl->u.funcs; p; p = p->next)
-    {
-        ast_func_t func = p->data;
-        env_entry_t entry = sym_lookup(_venv, func->name);
-        list_t q = func->params;
-        list_t r = entry->u.func.formals;
-        list_t s = tr_formals(entry->u.func.level)->next;
-
-        sym_begin_scope(_venv);
-        for (; q; q = q->next, r = r->next, s = s->next)
-        {
-            sym_enter(_venv,
-                      ((ast_field_t) q->data)->name,
-                      env_var_entry(s->data, r->data, false));
-        }
-        assert(!q && !r);
-        result = trans_expr(entry->u.func.level, func->body);
-        if (!ty_match(result.type, entry->u.func.result))
-            em_error(func->pos, "function body's type is incorrect");
-        sym_end_scope(_venv);
-    }
-
-    fr_add_frag(fr_proc_frag(ir_move_stmt(ir_tmp_expr(fr_rv()),
-                                          un_ex(result.expr)),
-                             tr_level_frame(level)));
-    return NULL;
+    return count;
 }
 
 static tr_expr_t trans_types_decl(tr_level_t level, ast_decl_t decl)
 {
-    list_t p, q;
+    list_t p;
+    int count = 0;
 
     /* Check for type redefinitions. */
-    for (p = decl->u.types; p && p->next; p = p->next)
-        for (q = p->next; q; q = q->next)
-        {
-            ast_nametype_t nt = q->data;
-            if (((ast_nametype_t) p->data)->name == nt->name)
-                em_error(decl->pos, "type '%s' redefined", sym_name(nt->name));
-        }
+    sym_begin_scope(_seen);
+    for (p = decl->u.types; p; p = p->next)
+    {
+        ast_nametype_t nt = p->data;
+        count++;
+        if (sym_lookup(_seen, nt->name))
+            em_error(decl->pos, "type '%s' redefined", sym_name(nt->name));
+        else
+            sym_enter(_seen, nt->name, nt->name);
+    }
+    sym_end_scope(_seen);
 
     /* Enter type placeholder into symbol table. */
     for (p = decl->u.types; p; p = p->next)
@@ -189,12 +577,14 @@ static tr_expr_t trans_types_decl(tr_level_t level, ast_decl_t decl)
         type->u.name.type = trans_type(nametype->type);
     }
 
-    /* Check for infinite recursive types. */
+    /* Resolve each name to its actual type once, checking for infinite
+     * recursive types on the way.  A chain can pass through every name
+     * of the group and then one declared before it. */
     for (p = decl->u.types; p; p = p->next)
     {
         ast_nametype_t nametype = p->data;
         type_t type = sym_lookup(_tenv, nametype->name);
-        if (ty_actual(type) == type)
+        if (!ty_resolve(type, count + 1))
             em_error(decl->pos,
                      "infinite recursive type '%s'",
                      sym_name(nametype->name));
@@ -203,11 +593,13 @@ static tr_expr_t trans_types_decl(tr_level_t level, ast_decl_t decl)
     return NULL;
 }
 
-static tr_expr_t trans_var_decl(tr_level_t level, ast_decl_t decl)
+/* Finish a variable declaration once its initializer is translated. */
+static tr_expr_t trans_var_decl(tr_level_t level,
+                                ast_decl_t decl,
+                                expr_type_t init)
 {
-    expr_type_t init = trans_expr(level, decl->u.var.init);
     type_t type = init.type;
-    tr_access_t access = tr_alloc_local(level, decl->u.var.escape);
+    tr_access_t access = TR(tr_alloc_local(level, decl->u.var.escape));
 
     if (decl->u.var.type)
     {
@@ -224,96 +616,113 @@ static tr_expr_t trans_var_decl(tr_level_t level, ast_decl_t decl)
         em_error(decl->pos, "can't assign void value to a variable");
     sym_enter(_venv, decl->u.var.var, env_var_entry(access, type, false));
 
-    return tr_assign_expr(tr_simple_var(access, level), init.expr);
+    return TR(tr_assign_expr(tr_simple_var(access, level), init.expr));
 }
 
-typedef tr_expr_t (*trans_decl_func)(tr_level_t level, ast_decl_t);
-/* XXX Keep sync with ast_decl_t's declaration! */
-static trans_decl_func _trans_decl_funcs[] =
-{
-    trans_funcs_decl,
-    trans_types_decl,
-    trans_var_decl,
-};
-
-static tr_expr_t trans_decl(tr_level_t level, ast_decl_t decl)
+static void trans_nil_expr(sem_frame_t *f)
 {
-    return _trans_decl_funcs[decl->kind](level, decl);
+    finish(expr_type(TR(tr_num_expr(0)), ty_nil()));
 }
 
-static expr_type_t trans_nil_expr(tr_level_t level, ast_expr_t expr)
+static void trans_var_expr(sem_frame_t *f)
 {
-    return expr_type(tr_num_expr(0), ty_nil());
-}
-
-static expr_type_t trans_var_expr(tr_level_t level, ast_expr_t expr)
-{
-    return trans_var(level, expr->u.var);
+    if (f->state++ == 0)
+        eval_var(f->level, ast_var(f->expr));
+    else
+        finish(_result);
 }
 
-static expr_type_t trans_num_expr(tr_level_t level, ast_expr_t expr)
+static void trans_num_expr(sem_frame_t *f)
 {
-    return expr_type(tr_num_expr(expr->u.num), ty_int());
+    finish(expr_type(TR(tr_num_expr(ast_num(f->expr))), ty_int()));
 }
 
-static expr_type_t trans_string_expr(tr_level_t level, ast_expr_t expr)
+static void trans_string_expr(sem_frame_t *f)
 {
-    return expr_type(tr_string_expr(expr->u.str), ty_string());
+    finish(expr_type(TR(tr_string_expr(ast_str(f->expr))), ty_string()));
 }
 
-static expr_type_t trans_call_expr(tr_level_t level, ast_expr_t expr)
+static void trans_call_expr(sem_frame_t *f)
 {
-    env_entry_t entry = sym_lookup(_venv, expr->u.call.func);
-    list_t l_formals, l_args, l_args2 = NULL, l_next = NULL;
-    int i;
+    struct ast_call_s *call = ast_call(f->expr);
+    env_entry_t entry = f->u.call.entry;
+    list_t l_args;
 
-    if (!entry)
+    switch (f->state)
     {
-        em_error(expr->pos,
-                 "undefined function '%s'",
-                 sym_name(expr->u.call.func));
-        return expr_type(NULL, ty_int());
+        case 0:
+            entry = f->u.call.entry = sym_lookup(_venv, call->func);
+            if (!entry)
+            {
+                em_error(ast_pos(f->expr),
+                         "undefined function '%s'",
+                         sym_name(call->func));
+                finish(expr_type(NULL, ty_int()));
+                return;
+            }
+            else if (entry->kind != ENV_FUNC_ENTRY)
+            {
+                em_error(ast_pos(f->expr),
+                         "'%s' is not a function",
+                         sym_name(call->func));
+                finish(expr_type(NULL, ty_int()));
+                return;
+            }
+            f->u.call.formals = entry->u.func.formals;
+            f->u.call.i = 1;
+            f->u.call.args.head = f->u.call.args.tail = NULL;
+            break;
+
+        case 1:
+            if (!ty_match(f->u.call.formals->data, _result.type))
+                em_error(ast_pos(f->expr),
+                         "passing argument %d of '%s' with wrong type",
+                         f->u.call.i,
+                         sym_name(call->func));
+            if (!_check_only)
+                list_enqueue(&f->u.call.args, list(_result.expr, NULL));
+            f->u.call.formals = f->u.call.formals->next;
+            f->u.call.i++;
+            break;
     }
-    else if (entry->kind != ENV_FUNC_ENTRY)
+
+    if (f->u.call.formals && f->u.call.i <= call->count)
     {
-        em_error(expr->pos,
-                 "'%s' is not a function",
-                 sym_name(expr->u.call.func));
-        return expr_type(NULL, ty_int());
+        f->state = 1;
+        eval_expr(f->level, ast_kid(call->first, f->u.call.i - 1));
+        return;
     }
-
-    for (l_formals = entry->u.func.formals, l_args = expr->u.call.args, i = 1;
-         l_formals && l_args;
-         l_formals = l_formals->next, l_args = l_args->next, i++)
+    if (f->u.call.formals)
+        em_error(ast_pos(f->expr), "expect more arguments");
+    else if (f->u.call.i <= call->count)
+        em_error(ast_pos(f->expr), "expect less arguments");
+
+    /* A lifted function is passed its free variables after its own
+     * arguments; lifting made sure their names see them here. */
+    for (l_args = entry->u.func.free; l_args && !_check_only;
+         l_args = l_args->next)
     {
-        expr_type_t et = trans_expr(level, (ast_expr_t) l_args->data);
-        if (!ty_match(l_formals->data, et.type))
-            em_error(expr->pos,
-                     "passing argument %d of '%s' with wrong type",
-                     i,
-                     sym_name(expr->u.call.func));
+        env_entry_t var = sym_lookup(_venv,
+                                     ((ast_field_t) l_args->data)->name);
 
-        if (l_args2)
-            l_next = l_next->next = list(et.expr, NULL);
-        else
-            l_args2 = l_next = list(et.expr, NULL);
+        assert(var && var->kind == ENV_VAR_ENTRY);
+        list_enqueue(&f->u.call.args,
+                     list(tr_simple_var(var->u.var.access, f->level), NULL));
     }
-    if (l_formals)
-        em_error(expr->pos, "expect more arguments");
-    else if (l_args)
-        em_error(expr->pos, "expect less arguments");
 
-    return expr_type(tr_call_expr(entry->u.func.level,
-                                  entry->u.func.label,
-                                  l_args2),
-                     ty_actual(entry->u.func.result));
+    finish(expr_type(TR(tr_call_expr(f->level,
+                                     entry->u.func.level,
+                                     entry->u.func.label,
+                                     f->u.call.args.head)),
+                     ty_actual(entry->u.func.result)));
 }
 
-static expr_type_t trans_op_expr(tr_level_t level, ast_expr_t expr)
+static expr_type_t trans_op(ast_expr_t expr,
+                            expr_type_t left,
+                            expr_type_t right)
 {
-    ast_binop_t op = expr->u.op.op;
-    expr_type_t left = trans_expr(level, expr->u.op.left);
-    expr_type_t right = trans_expr(level, expr->u.op.right);
+    struct ast_op_s *node = ast_op(expr);
+    ast_binop_t op = node->op;
 
     switch (op) {
         case AST_PLUS:
@@ -321,24 +730,25 @@ static expr_type_t trans_op_expr(tr_level_t level, ast_expr_t expr)
         case AST_TIMES:
         case AST_DIVIDE:
             if (left.type->kind != TY_INT)
-                em_error(expr->u.op.left->pos, "integer required");
+                em_error(ast_pos(node->left), "integer required");
             if (right.type->kind != TY_INT)
-                em_error(expr->u.op.right->pos, "integer required");
+                em_error(ast_pos(node->right), "integer required");
             return expr_type(
-              tr_op_expr(op-AST_PLUS+IR_PLUS, left.expr, right.expr),
+              TR(tr_op_expr(op-AST_PLUS+IR_PLUS, left.expr, right.expr)),
               ty_int());
 
         case AST_EQ:
         case AST_NEQ: {
             tr_expr_t result = NULL;
             if (!ty_match(left.type, right.type))
-                em_error(expr->pos,
+                em_error(ast_pos(expr),
                          "the type of two operands must be the same");
             else if (left.type->kind == TY_STRING)
-                result = tr_string_rel_expr(
-                  op-AST_EQ+IR_EQ, left.expr, right.expr);
+                result = TR(tr_string_rel_expr(
+                  op-AST_EQ+IR_EQ, left.expr, right.expr));
             else
-                result = tr_rel_expr(op-AST_EQ+IR_EQ, left.expr, right.expr);
+                result = TR(tr_rel_expr(
+                  op-AST_EQ+IR_EQ, left.expr, right.expr));
             return expr_type(result, ty_int());
         }
 
@@ -348,16 +758,17 @@ static expr_type_t trans_op_expr(tr_level_t level, ast_expr_t expr)
         case AST_GE: {
             tr_expr_t result = NULL;
             if (!ty_match(left.type, right.type))
-                em_error(expr->pos,
+                em_error(ast_pos(expr),
                          "the type of two operands must be the same");
             if (left.type->kind != TY_INT && left.type->kind != TY_STRING)
-                em_error(expr->pos,
+                em_error(ast_pos(expr),
                          "the type of comparison's operand must be int or string");
             if (left.type->kind == TY_STRING)
-                result = tr_string_rel_expr(
-                  op-AST_LT+IR_LT, left.expr, right.expr);
+                result = TR(tr_string_rel_expr(
+                  op-AST_LT+IR_LT, left.expr, right.expr));
             else
-                result = tr_rel_expr(op-AST_LT+IR_LT, left.expr, right.expr);
+                result = TR(tr_rel_expr(
+                  op-AST_LT+IR_LT, left.expr, right.expr));
             return expr_type(result, left.type);
         }
     }
@@ -366,184 +777,395 @@ static expr_type_t trans_op_expr(tr_level_t level, ast_expr_t expr)
     return expr_type(NULL, NULL);
 }
 
-static expr_type_t trans_record_expr(tr_level_t level, ast_expr_t expr)
+static void trans_op_expr(sem_frame_t *f)
+{
+    switch (f->state++)
+    {
+        case 0:
+            eval_expr(f->level, ast_op(f->expr)->left);
+            break;
+
+        case 1:
+            f->u.parts.first = _result;
+            eval_expr(f->level, ast_op(f->expr)->right);
+            break;
+
+        case 2:
+            finish(trans_op(f->expr, f->u.parts.first, _result));
+            break;
+    }
+}
+
+static void trans_record_expr(sem_frame_t *f)
 {
-    type_t type = lookup_type(expr->u.record.type, expr->pos);
-    list_t p, q;
-    list_t fields = NULL, next = NULL;
-    int size = 0;
+    struct ast_record_s *record = ast_record(f->expr);
+    type_t type = f->u.record.type;
 
-    if (!type)
-        return expr_type(NULL, ty_nil());
-    if (type->kind != TY_RECORD)
-        em_error(expr->pos,
-                 "'%s' is not a record type",
-                 sym_name(expr->u.record.type));
-    for (p = type->u.record, q = expr->u.record.efields;
-         p && q;
-         p = p->next, q = q->next, size++)
-    {
-        ast_efield_t efield = q->data;
-        expr_type_t et = trans_expr(level, efield->expr);
-        if (!ty_match(((ty_field_t) p->data)->type, et.type))
-            em_error(efield->pos, "wrong field type");
-        if (fields)
-            next = next->next = list(et.expr, NULL);
-        else
-            fields = next = list(et.expr, NULL);
+    switch (f->state)
+    {
+        case 0:
+            type = f->u.record.type = lookup_type(record->type,
+                                                  ast_pos(f->expr));
+            if (!type)
+            {
+                finish(expr_type(NULL, ty_nil()));
+                return;
+            }
+            if (type->kind != TY_RECORD)
+                em_error(ast_pos(f->expr),
+                         "'%s' is not a record type",
+                         sym_name(record->type));
+            f->u.record.fields = type->u.record.fields;
+            f->u.record.efields = record->efields;
+            f->u.record.exprs.head = f->u.record.exprs.tail = NULL;
+            f->u.record.size = 0;
+            break;
+
+        case 1: {
+            ast_efield_t efield = f->u.record.efields->data;
+
+            if (!ty_match(((ty_field_t) f->u.record.fields->data)->type,
+                          _result.type))
+                em_error(efield->pos, "wrong field type");
+            if (!_check_only)
+                list_enqueue(&f->u.record.exprs, list(_result.expr, NULL));
+            f->u.record.fields = f->u.record.fields->next;
+            f->u.record.efields = f->u.record.efields->next;
+            f->u.record.size++;
+            break;
+        }
     }
-    if (p || q)
-        em_error(expr->pos, "wrong field number");
-    return expr_type(tr_record_expr(fields, size), type);
+
+    if (f->u.record.fields && f->u.record.efields)
+    {
+        f->state = 1;
+        eval_expr(f->level,
+                  ((ast_efield_t) f->u.record.efields->data)->expr);
+        return;
+    }
+    if (f->u.record.fields || f->u.record.efields)
+        em_error(ast_pos(f->expr), "wrong field number");
+    finish(expr_type(TR(tr_record_expr(f->u.record.exprs.head,
+                                       f->u.record.size)),
+                     type));
 }
 
-static expr_type_t trans_array_expr(tr_level_t level, ast_expr_t expr)
+static void trans_array_expr(sem_frame_t *f)
 {
-    type_t type = lookup_type(expr->u.array.type, expr->pos);
-    expr_type_t size = trans_expr(level, expr->u.array.size);
-    expr_type_t init = trans_expr(level, expr->u.array.init);
+    struct ast_array_s *array = ast_array(f->expr);
+    type_t type = f->u.parts.type;
+    expr_type_t size = f->u.parts.first, init = _result;
+
+    switch (f->state++)
+    {
+        case 0:
+            f->u.parts.type = lookup_type(array->type, ast_pos(f->expr));
+            eval_expr(f->level, array->size);
+            return;
+
+        case 1:
+            f->u.parts.first = _result;
+            eval_expr(f->level, array->init);
+            return;
+    }
 
     if (!type)
-        return expr_type(NULL, ty_int());
+    {
+        finish(expr_type(NULL, ty_int()));
+        return;
+    }
     if (type->kind != TY_ARRAY)
-        em_error(expr->pos,
+        em_error(ast_pos(f->expr),
                  "'%s' is not an array type",
-                 sym_name(expr->u.array.type));
+                 sym_name(array->type));
     if (size.type->kind != TY_INT)
-        em_error(expr->pos, "array's size must be the int type");
+        em_error(ast_pos(f->expr), "array's size must be the int type");
     if (!ty_match(type->u.array, init.type))
-        em_error(expr->pos, "initializer has incorrect type");
-    return expr_type(tr_array_expr(size.expr, init.expr), type);
+        em_error(ast_pos(f->expr), "initializer has incorrect type");
+    finish(expr_type(TR(tr_array_expr(size.expr, init.expr)), type));
 }
 
-static expr_type_t trans_seq_expr(tr_level_t level, ast_expr_t expr)
+static void trans_seq_expr(sem_frame_t *f)
 {
-    list_t p = expr->u.seq;
-    list_t stmts = NULL, next = NULL;
+    struct ast_seq_s *seq = ast_seq(f->expr);
 
-    for (; p; p = p->next)
+    if (f->state == 0)
     {
-        expr_type_t et = trans_expr(level, (ast_expr_t) p->data);
-        if (stmts)
-            next = next->next = list(et.expr, NULL);
-        else
-            stmts = next = list(et.expr, NULL);
-        if (!p->next)
-            return expr_type(tr_seq_expr(stmts), et.type);
+        if (!seq->count)
+        {
+            finish(expr_type(TR(tr_num_expr(0)), ty_void()));
+            return;
+        }
+        f->state = 1;
+        f->u.seq.i = 0;
+        f->u.seq.stmts.head = f->u.seq.stmts.tail = NULL;
     }
-    return expr_type(tr_num_expr(0), ty_void());
+    else
+    {
+        if (!_check_only)
+            list_enqueue(&f->u.seq.stmts, list(_result.expr, NULL));
+        if (++f->u.seq.i == seq->count)
+        {
+            finish(expr_type(TR(tr_seq_expr(f->u.seq.stmts.head)),
+                             _result.type));
+            return;
+        }
+    }
+    eval_expr(f->level, ast_kid(seq->first, f->u.seq.i));
 }
 
-static expr_type_t trans_if_expr(tr_level_t level, ast_expr_t expr)
+static void trans_if_expr(sem_frame_t *f)
 {
-    expr_type_t cond = trans_expr(level, expr->u.if_.cond);
-    expr_type_t then = trans_expr(level, expr->u.if_.then);
+    struct ast_if_s *node = ast_if(f->expr);
+    expr_type_t cond = f->u.parts.first, then = f->u.parts.second;
 
-    if (cond.type->kind != TY_INT)
-        em_error(expr->pos,
-                 "condition's type must be integer");
-    if (expr->u.if_.else_)
+    switch (f->state++)
     {
-        expr_type_t else_ = trans_expr(level, expr->u.if_.else_);
-        if (!ty_match(then.type, else_.type))
-            em_error(expr->pos, "types of then and else differ");
-        return expr_type(tr_if_expr(cond.expr, then.expr, else_.expr),
-                         then.type);
+        case 0:
+            eval_expr(f->level, node->cond);
+            return;
+
+        case 1:
+            f->u.parts.first = _result;
+            eval_expr(f->level, node->then);
+            return;
+
+        case 2:
+            then = f->u.parts.second = _result;
+            if (cond.type->kind != TY_INT)
+                em_error(ast_pos(f->expr),
+                         "condition's type must be integer");
+            if (node->else_)
+            {
+                eval_expr(f->level, node->else_);
+                return;
+            }
+            else if (then.type->kind != TY_VOID)
+                em_error(ast_pos(f->expr), "if-then should return nothing");
+            finish(expr_type(TR(tr_if_expr(cond.expr, then.expr, NULL)),
+                             ty_void()));
+            return;
     }
-    else if (then.type->kind != TY_VOID)
-        em_error(expr->pos, "if-then should return nothing");
-    return expr_type(tr_if_expr(cond.expr, then.expr, NULL), ty_void());
+
+    if (!ty_match(then.type, _result.type))
+        em_error(ast_pos(f->expr), "types of then and else differ");
+    finish(expr_type(TR(tr_if_expr(cond.expr, then.expr, _result.expr)),
+                     then.type));
 }
 
-static expr_type_t trans_while_expr(tr_level_t level, ast_expr_t expr)
+static void trans_while_expr(sem_frame_t *f)
 {
-    expr_type_t cond = trans_expr(level, expr->u.while_.cond);
-    expr_type_t body = trans_expr(level, expr->u.while_.body);
+    struct ast_while_s *node = ast_while(f->expr);
+    expr_type_t cond = f->u.parts.first, body = _result;
+
+    switch (f->state++)
+    {
+        case 0:
+            eval_expr(f->level, node->cond);
+            return;
+
+        case 1:
+            f->u.parts.first = _result;
+            eval_expr(f->level, node->body);
+            return;
+    }
+
     if (cond.type->kind != TY_INT)
-        em_error(expr->pos, "condition's type must be integer");
+        em_error(ast_pos(f->expr), "condition's type must be integer");
     if (body.type->kind != TY_VOID)
-        em_error(expr->pos, "while should return nothing");
-    return expr_type(tr_while_expr(cond.expr, body.expr), ty_void());
+        em_error(ast_pos(f->expr), "while should return nothing");
+    finish(expr_type(TR(tr_while_expr(cond.expr, body.expr)), ty_void()));
 }
 
-static expr_type_t trans_for_expr(tr_level_t level, ast_expr_t expr)
+static void trans_for_expr(sem_frame_t *f)
 {
-    expr_type_t lo = trans_expr(level, expr->u.for_.lo);
-    expr_type_t hi = trans_expr(level, expr->u.for_.hi);
-    expr_type_t body;
-    tr_access_t access = tr_alloc_local(level, expr->u.for_.escape);
+    struct ast_for_s *node = ast_for(f->expr);
+    expr_type_t lo = f->u.parts.first, hi = f->u.parts.second;
+    tr_access_t access = f->u.parts.access;
 
-    if (lo.type->kind != TY_INT)
-        em_error(expr->pos, "lo expression should be int type");
-    if (hi.type->kind != TY_INT)
-        em_error(expr->pos, "hi expression should be int type");
-    sym_begin_scope(_venv);
-    sym_enter(_venv, expr->u.for_.var, env_var_entry(access, ty_int(), true));
-    /* TODO Check assignment to the variable. */
-    body = trans_expr(level, expr->u.for_.body);
-    if (body.type->kind != TY_VOID)
-        em_error(expr->pos, "for should return nothing");
+    switch (f->state++)
+    {
+        case 0:
+            eval_expr(f->level, node->lo);
+            return;
+
+        case 1:
+            f->u.parts.first = _result;
+            eval_expr(f->level, node->hi);
+            return;
+
+        case 2:
+            hi = f->u.parts.second = _result;
+            access = f->u.parts.access =
+              TR(tr_alloc_local(f->level, node->escape));
+            if (lo.type->kind != TY_INT)
+                em_error(ast_pos(f->expr), "lo expression should be int type");
+            if (hi.type->kind != TY_INT)
+                em_error(ast_pos(f->expr), "hi expression should be int type");
+            sym_begin_scope(_venv);
+            sym_enter(_venv, node->var, env_var_entry(access, ty_int(), true));
+            /* TODO Check assignment to the variable. */
+            eval_expr(f->level, node->body);
+            return;
+    }
+
+    if (_result.type->kind != TY_VOID)
+        em_error(ast_pos(f->expr), "for should return nothing");
     sym_end_scope(_venv);
-    return expr_type(tr_for_expr(access, lo.expr, hi.expr, body.expr),
-                     ty_void());
+    finish(expr_type(TR(tr_for_expr(access, lo.expr, hi.expr, _result.expr)),
+                     ty_void()));
 }
 
-static expr_type_t trans_break_expr(tr_level_t level, ast_expr_t expr)
+static void trans_break_expr(sem_frame_t *f)
 {
     /* TODO Check for outer for or while statement. */
-    return expr_type(NULL, ty_void());
+    finish(expr_type(NULL, ty_void()));
 }
 
-static expr_type_t trans_let_expr(tr_level_t level, ast_expr_t expr)
+/* The declarations are taken one at a time: a type group at once, a
+ * variable once its initializer is done, and a function group one body
+ * at a time unless its bodies go to the pool. */
+enum
 {
-    expr_type_t result;
-    list_t p;
-    list_t tr_exprs = NULL;
+    LET_BEGIN, LET_DECL, LET_VAR, LET_BODY, LET_BODY_DONE, LET_DONE,
+};
 
-    sym_begin_scope(_venv);
-    sym_begin_scope(_tenv);
+static void trans_let_expr(sem_frame_t *f)
+{
+    ast_decl_t decl;
+    ast_func_t func;
+    expr_type_t result;
+    tr_expr_t tr_expr;
+    int count;
 
-    for (p = expr->u.let.decls; p; p = p->next)
+    switch (f->state)
     {
-        tr_expr_t tr_expr = trans_decl(level, p->data);
-        if (tr_expr)
-        {
-            tr_exprs = join_list(tr_exprs, list(tr_expr, NULL));
-        }
+        case LET_BEGIN:
+            sym_begin_scope(_venv);
+            sym_begin_scope(_tenv);
+            f->u.let.decls = ast_let(f->expr)->decls;
+            f->u.let.exprs.head = f->u.let.exprs.tail = NULL;
+            f->state = LET_DECL;
+            return;
+
+        case LET_DECL:
+            if (!f->u.let.decls)
+            {
+                f->state = LET_DONE;
+                eval_expr(f->level, ast_let(f->expr)->body);
+                return;
+            }
+            decl = f->u.let.decls->data;
+            switch (decl->kind)
+            {
+                case AST_FUNCS_DECL:
+                    count = enter_funcs(f->level, decl);
+                    /* Translate the possibly mutually recursive
+                     * functions. */
+                    if (sem_jobs > 1 && !_in_pool && count >= PAR_MIN_BODIES)
+                        trans_bodies(decl, count);
+                    else
+                    {
+                        f->u.let.funcs = decl->u.funcs;
+                        f->state = LET_BODY;
+                        return;
+                    }
+                    break;
+
+                case AST_TYPES_DECL:
+                    trans_types_decl(f->level, decl);
+                    break;
+
+                case AST_VAR_DECL:
+                    f->state = LET_VAR;
+                    eval_expr(f->level, decl->u.var.init);
+                    return;
+            }
+            f->u.let.decls = f->u.let.decls->next;
+            return;
+
+        case LET_VAR:
+            tr_expr = trans_var_decl(f->level, f->u.let.decls->data, _result);
+            if (tr_expr)
+                list_enqueue(&f->u.let.exprs, list(tr_expr, NULL));
+            f->u.let.decls = f->u.let.decls->next;
+            f->state = LET_DECL;
+            return;
+
+        case LET_BODY:
+            if (!f->u.let.funcs)
+            {
+                f->u.let.decls = f->u.let.decls->next;
+                f->state = LET_DECL;
+                return;
+            }
+            func = f->u.let.func = f->u.let.funcs->data;
+            f->u.let.funcs = f->u.let.funcs->next;
+            if (_check_only && func->checked)
+            {
+                replay_diags(func);
+                return;
+            }
+            em_diags(&f->u.let.first);
+            f->state = LET_BODY_DONE;
+            eval_body(func);
+            return;
+
+        case LET_BODY_DONE:
+            /* A pool thread cannot allocate in the unit's arena; its
+             * functions are covered by the cache of the body they are
+             * in. */
+            if (_check_only && !_in_pool)
+                keep_diags(f->u.let.func, f->u.let.first);
+            f->state = LET_BODY;
+            return;
     }
 
-    result = trans_expr(level, expr->u.let.body);
-    tr_exprs = join_list(tr_exprs, list(result.expr, NULL));
-    result.expr = tr_seq_expr(tr_exprs);
+    result = _result;
+    if (!_check_only)
+    {
+        list_enqueue(&f->u.let.exprs, list(result.expr, NULL));
+        result.expr = tr_seq_expr(f->u.let.exprs.head);
+    }
 
     sym_end_scope(_venv);
     sym_end_scope(_tenv);
 
-    return result;
+    finish(result);
 }
 
-static expr_type_t trans_assign_expr(tr_level_t level, ast_expr_t expr)
+static void trans_assign_expr(sem_frame_t *f)
 {
-    expr_type_t var = trans_var(level, expr->u.assign.var);
-    expr_type_t et = trans_expr(level, expr->u.assign.expr);
+    struct ast_assign_s *node = ast_assign(f->expr);
+    expr_type_t var = f->u.parts.first, et = _result;
+
+    switch (f->state++)
+    {
+        case 0:
+            eval_var(f->level, node->var);
+            return;
+
+        case 1:
+            f->u.parts.first = _result;
+            eval_expr(f->level, node->expr);
+            return;
+    }
 
     if (!ty_match(var.type, et.type))
-        em_error(expr->pos, "type mismatch");
+        em_error(ast_pos(f->expr), "type mismatch");
 
-    if (expr->u.assign.var->kind == AST_SIMPLE_VAR && var.type->kind == TY_INT)
+    if (ast_var_kind(node->var) == AST_SIMPLE_VAR && var.type->kind == TY_INT)
     {
         /* Check for the assignment to the for variable. */
-        ast_var_t v = expr->u.assign.var;
-        env_entry_t entry = sym_lookup(_venv, v->u.simple);
+        env_entry_t entry = sym_lookup(_venv, ast_var_name(node->var));
         if (entry && entry->kind == ENV_VAR_ENTRY && entry->u.var.for_)
-            em_error(expr->pos, "assigning to the for variable");
+            em_error(ast_pos(f->expr), "assigning to the for variable");
     }
 
-    return expr_type(tr_assign_expr(var.expr, et.expr), ty_void());
+    finish(expr_type(TR(tr_assign_expr(var.expr, et.expr)), ty_void()));
 }
 
-typedef expr_type_t (*trans_expr_func)(tr_level_t level, ast_expr_t);
-static trans_expr_func _trans_expr_funcs[] =
+static trans_step_t _trans_expr_funcs[] =
 {
     trans_nil_expr,
     trans_var_expr,
@@ -562,9 +1184,18 @@ static trans_expr_func _trans_expr_funcs[] =
     trans_assign_expr,
 };
 
-static expr_type_t trans_expr(tr_level_t level, ast_expr_t expr)
+static void eval_expr(tr_level_t level, ast_expr_t expr)
 {
-    return _trans_expr_funcs[expr->kind](level, expr);
+    push_frame(_trans_expr_funcs[ast_kind(expr)], level)->expr = expr;
+}
+
+static expr_type_t run_expr(tr_level_t level, ast_expr_t expr)
+{
+    int base = _frame_count;
+
+    eval_expr(level, expr);
+    run(base);
+    return _result;
 }
 
 static type_t trans_name_type(ast_type_t type)
@@ -628,96 +1259,165 @@ static type_t trans_type(ast_type_t type)
     return _trans_type_funcs[type->kind](type);
 }
 
-static expr_type_t trans_simple_var(tr_level_t level, ast_var_t var)
+static void trans_simple_var(sem_frame_t *f)
 {
-    env_entry_t entry = sym_lookup(_venv, var->u.simple);
+    ast_var_t var = f->var;
+    env_entry_t entry = sym_lookup(_venv, ast_var_name(var));
 
     if (!entry)
     {
-        em_error(var->pos, "undefined variable '%s'", sym_name(var->u.simple));
-        return expr_type(tr_num_expr(0), ty_int());
+        em_error(ast_var_pos(var),
+                 "undefined variable '%s'",
+                 sym_name(ast_var_name(var)));
+        finish(expr_type(TR(tr_num_expr(0)), ty_int()));
+        return;
     }
     else if (entry->kind != ENV_VAR_ENTRY)
     {
-        em_error(var->pos,
+        em_error(ast_var_pos(var),
                  "expected '%s' to be a variable, not a function",
-                 sym_name(var->u.simple));
-        return expr_type(tr_num_expr(0), ty_int());
+                 sym_name(ast_var_name(var)));
+        finish(expr_type(TR(tr_num_expr(0)), ty_int()));
+        return;
     }
 
-    return expr_type(tr_simple_var(entry->u.var.access, level),
-                     ty_actual(entry->u.var.type));
+    finish(expr_type(TR(tr_simple_var(entry->u.var.access, f->level)),
+                     ty_actual(entry->u.var.type)));
 }
 
-static expr_type_t trans_field_var(tr_level_t level, ast_var_t var)
+static void trans_field_var(sem_frame_t *f)
 {
-    expr_type_t et = trans_var(level, var->u.field.var);
-    list_t p;
-    int i;
+    ast_var_t var = f->var;
+    expr_type_t et = _result;
+    ty_field_t field;
+
+    if (f->state++ == 0)
+    {
+        eval_var(f->level, ast_var_base(var));
+        return;
+    }
 
     if (et.type->kind != TY_RECORD)
     {
-        em_error(var->pos, "expected record type variable");
-        return expr_type(tr_num_expr(0), ty_int());
+        em_error(ast_var_pos(var), "expected record type variable");
+        finish(expr_type(TR(tr_num_expr(0)), ty_int()));
+        return;
     }
 
-    for (p = et.type->u.record, i = 0; p; p = p->next, ++i)
+    field = ty_lookup_field(et.type, ast_var_name(var));
+    if (field)
     {
-        ty_field_t field = p->data;
-        if (field->name == var->u.field.field)
-        {
-            return expr_type(tr_field_var(et.expr, i),
-                             ty_actual(field->type));
-        }
+        finish(expr_type(TR(tr_field_var(et.expr, field->offset)),
+                         ty_actual(field->type)));
+        return;
     }
 
-    em_error(var->pos,
+    em_error(ast_var_pos(var),
              "there is no field named '%s'",
-             sym_name(var->u.field.field));
-    return expr_type(tr_num_expr(0), ty_int());
+             sym_name(ast_var_name(var)));
+    finish(expr_type(TR(tr_num_expr(0)), ty_int()));
 }
 
-static expr_type_t trans_sub_var(tr_level_t level, ast_var_t var)
+static void trans_sub_var(sem_frame_t *f)
 {
-    expr_type_t et = trans_var(level, var->u.sub.var);
-    expr_type_t sub = trans_expr(level, var->u.sub.sub);
+    ast_var_t var = f->var;
+    expr_type_t et = f->u.parts.first, sub = _result;
+
+    switch (f->state++)
+    {
+        case 0:
+            eval_var(f->level, ast_var_base(var));
+            return;
+
+        case 1:
+            f->u.parts.first = _result;
+            eval_expr(f->level, ast_var_sub(var));
+            return;
+    }
 
     if (et.type->kind != TY_ARRAY)
     {
-        em_error(var->pos, "expected array type variable");
-        return expr_type(NULL, ty_int());
+        em_error(ast_var_pos(var), "expected array type variable");
+        finish(expr_type(NULL, ty_int()));
+        return;
     }
     if (sub.type->kind != TY_INT)
-        em_error(var->pos, "expected integer type subscript");
-    return expr_type(NULL, ty_actual(et.type->u.array));
+        em_error(ast_var_pos(var), "expected integer type subscript");
+    finish(expr_type(NULL, ty_actual(et.type->u.array)));
 }
 
-typedef expr_type_t (*trans_var_func)(tr_level_t level, ast_var_t);
-static trans_var_func _trans_var_funcs[] =
+static trans_step_t _trans_var_funcs[] =
 {
     trans_simple_var,
     trans_field_var,
     trans_sub_var,
 };
 
-static expr_type_t trans_var(tr_level_t level, ast_var_t var)
+static void eval_var(tr_level_t level, ast_var_t var)
 {
-    return _trans_var_funcs[var->kind](level, var);
+    push_frame(_trans_var_funcs[ast_var_kind(var)], level)->var = var;
 }
 
-void sem_trans_prog(ast_expr_t prog)
+/* The base environment is built once per thread and stays under the
+ * scope of every program compiled there, so it outlives the unit, and so
+ * do its symbols and labels. */
+static void base_env(void)
 {
-    expr_type_t result;
+    arena_t unit;
 
+    if (_venv)
+        return;
+    unit = unit_set_arena(NULL);
     _venv = env_base_venv();
     _tenv = env_base_tenv();
-    result = trans_expr(tr_outermost(), prog);
+    _seen = sym_empty();
+    tmp_keep_labels();
+    sym_keep();
+    unit_set_arena(unit);
+}
+
+void sem_reset(void)
+{
+    base_env();
+    sym_reset();
+}
+
+static expr_type_t trans_prog(ast_expr_t prog)
+{
+    expr_type_t result;
+
+    base_env();
+    sym_begin_scope(_venv);
+    sym_begin_scope(_tenv);
+    result = run_expr(TR(tr_outermost()), prog);
+    sym_end_scope(_venv);
+    sym_end_scope(_tenv);
+    return result;
+}
+
+bool sem_trans_prog(ast_expr_t prog, FILE *out)
+{
+    expr_type_t result;
+
+    _check_only = false;
+    result = trans_prog(prog);
     if (em_any_errors)
+        return false;
+
+    if (out)
     {
-        exit(1);
+        fr_pp_frags(out);
+        fprintf(out, "MAIN PROGRAM:\n");
+        tr_pp_expr(out, result.expr);
     }
+    return true;
+}
 
-    fr_pp_frags(stdout);
-    fprintf(stdout, "MAIN PROGRAM:\n");
-    tr_pp_expr(result.expr);
+bool sem_check_prog(ast_expr_t prog)
+{
+    _check_only = true;
+    em_set_log(true);
+    trans_prog(prog);
+    em_set_log(false);
+    return !em_any_errors;
 }
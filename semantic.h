@@ -1,8 +1,23 @@
 #ifndef INCLUDE__SEMANTIC_H
 #define INCLUDE__SEMANTIC_H
 
+#include <stdio.h>
+
 #include "ast.h"
 
-void sem_trans_prog(ast_expr_t prog);
+/* Threads to check and translate the bodies of a big declaration group on,
+ * beside one another; 1, the default, keeps them on the calling thread.
+ * Either way the output and diagnostics are the same. */
+extern int sem_jobs;
+
+/* Start a new compilation unit, before it is parsed: the symbols interned
+ * for the last one are forgotten. */
+void sem_reset(void);
+/* Check and translate prog, printing its fragments to out unless it is
+ * NULL; false if any error was reported. */
+bool sem_trans_prog(ast_expr_t prog, FILE *out);
+/* Type-check prog without translating it; false if any error was
+ * reported. */
+bool sem_check_prog(ast_expr_t prog);
 
 #endif
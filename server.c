@@ -0,0 +1,342 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "tiger.h"
+
+/* A client gets this long to send each part of its request, which may be
+ * no bigger than SRV_MAX_REQUEST, before the server gives up on it. */
+#define SRV_TIMEOUT 10
+#define SRV_MAX_REQUEST (64 * 1024 * 1024)
+
+/* One request per connection.  The client sends the source and shuts down
+ * its side; the server answers with
+ *
+ *     <ok> <output length> <diagnostic count>\n
+ *     <output>
+ *     <line> <column> <message>\n     once per diagnostic
+ *
+ * and closes the connection. */
+
+/* Read until end of file, or fail once more than max bytes have come.
+ * The result is NUL-terminated, past the len bytes read.  Room is made
+ * for hint bytes from the start, so a source of about the expected size
+ * arrives in a few reads and no copies. */
+static char *read_all(int fd, size_t max, size_t hint, size_t *len)
+{
+    size_t cap = (hint < max ? hint : max) + 2;
+    char *buf;
+
+    /* Past the hint, one byte is left for the read that finds the end. */
+    if (cap < 4096)
+        cap = 4096;
+    buf = checked_malloc(cap);
+
+    *len = 0;
+    for (;;)
+    {
+        ssize_t n;
+
+        if (*len == cap - 1)
+        {
+            char *p = checked_malloc(cap * 2);
+            memcpy(p, buf, *len);
+            free(buf);
+            buf = p;
+            cap *= 2;
+        }
+        n = read(fd, buf + *len, cap - 1 - *len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 || *len + n > max)
+        {
+            free(buf);
+            return NULL;
+        }
+        if (n == 0)
+        {
+            buf[*len] = 0;
+            return buf;
+        }
+        *len += n;
+    }
+}
+
+static bool write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool unix_address(struct sockaddr_un *addr, string_t path)
+{
+    if (strlen(path) >= sizeof(addr->sun_path))
+    {
+        fprintf(stderr, "socket path too long: %s\n", path);
+        return false;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+static bool _check_only = false;
+
+/* Answer one request; *hint is the size of the last source read. */
+static void answer(tiger_ctx_t ctx, int conn, size_t *hint)
+{
+    const tiger_diag_t *diags;
+    const char *out;
+    char *src, *resp;
+    size_t src_len, out_len, resp_len;
+    FILE *fp;
+    bool ok;
+    int count, i;
+
+    src = read_all(conn, SRV_MAX_REQUEST, *hint, &src_len);
+    if (!src)
+        return;
+    *hint = src_len;
+    if (_check_only)
+        ok = tiger_check_buffer(ctx, src, src_len);
+    else
+        ok = tiger_compile_buffer(ctx, src, src_len);
+    out = tiger_output(ctx, &out_len);
+    diags = tiger_diagnostics(ctx, &count);
+
+    fp = open_memstream(&resp, &resp_len);
+    assert(fp);
+    fprintf(fp, "%d %zu %d\n", ok, out_len, count);
+    fwrite(out, 1, out_len, fp);
+    for (i = 0; i < count; i++)
+        fprintf(fp, "%d %d %s\n",
+                diags[i].line, diags[i].column, diags[i].message);
+    fclose(fp);
+    write_all(conn, resp, resp_len);
+    free(resp);
+    free(src);
+}
+
+static void *serve_clients(void *arg)
+{
+    int sock = *(int *) arg;
+    tiger_ctx_t ctx = tiger_ctx_new();
+    struct timeval timeout = { SRV_TIMEOUT, 0 };
+    size_t hint = 0;
+
+    for (;;)
+    {
+        int conn = accept(sock, NULL, NULL);
+
+        if (conn < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            perror("accept");
+            break;
+        }
+        /* A client that stops sending, or reading, must not keep the
+         * thread from the others. */
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        answer(ctx, conn, &hint);
+        close(conn);
+    }
+    tiger_ctx_free(ctx);
+    return NULL;
+}
+
+int srv_serve(string_t path, int jobs, bool check_only)
+{
+    struct sockaddr_un addr;
+    pthread_t *threads;
+    int sock, i;
+
+    _check_only = check_only;
+    if (!unix_address(&addr, path))
+        return 1;
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0)
+    {
+        perror("socket");
+        return 1;
+    }
+    unlink(path);
+    if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) != 0
+        || listen(sock, 64) != 0)
+    {
+        perror(path);
+        close(sock);
+        return 1;
+    }
+    /* A client that goes away must not take the server with it. */
+    signal(SIGPIPE, SIG_IGN);
+
+    threads = checked_malloc(jobs * sizeof(*threads));
+    for (i = 0; i < jobs; i++)
+        if (pthread_create(&threads[i], NULL, serve_clients, &sock) != 0)
+        {
+            fprintf(stderr, "cannot create thread\n");
+            exit(1);
+        }
+    for (i = 0; i < jobs; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+    close(sock);
+    unlink(path);
+    return 1;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Read the number at *p, which must be followed by sep no later than
+ * end, and move *p past sep. */
+static bool read_number(char **p, char *end, char sep, long long *value)
+{
+    char *q;
+
+    if (!isdigit((unsigned char) **p) && **p != '-')
+        return false;
+    errno = 0;
+    *value = strtoll(*p, &q, 10);
+    if (errno || q > end || *q != sep)
+        return false;
+    *p = q + 1;
+    return true;
+}
+
+/* Print the server's answer the way a local compile prints it:
+ * diagnostics on stderr, then the fragments on stdout.  resp is
+ * NUL-terminated, so no number is read past its end. */
+static bool print_answer(string_t filename, char *resp, size_t len)
+{
+    char *out, *p = resp, *end = resp + len, *eol;
+    long long ok, out_len, count, line, column;
+    int i;
+
+    eol = memchr(resp, '\n', len);
+    if (!eol || !read_number(&p, eol, ' ', &ok)
+        || !read_number(&p, eol, ' ', &out_len)
+        || !read_number(&p, eol, '\n', &count)
+        || out_len < 0 || out_len > end - p)
+    {
+        fprintf(stderr, "%s: bad answer from server\n", filename);
+        return false;
+    }
+    out = p;
+    p = out + out_len;
+    for (i = 0; i < count && p < end; i++)
+    {
+        eol = memchr(p, '\n', end - p);
+        if (!eol || !read_number(&p, eol, ' ', &line)
+            || !read_number(&p, eol, ' ', &column))
+            break;
+        fprintf(stderr, "%s:%lld.%lld: %.*s\n",
+                filename, line, column, (int) (eol - p), p);
+        p = eol + 1;
+    }
+    fwrite(out, 1, out_len, stdout);
+    return ok != 0;
+}
+
+static bool request(struct sockaddr_un *addr, string_t filename)
+{
+    struct stat st;
+    char *src, *resp;
+    size_t src_len, resp_len;
+    bool ok;
+    int fd, sock;
+
+    fd = open(filename, O_RDONLY);
+    src = fd < 0 ? NULL
+        : read_all(fd, SIZE_MAX, fstat(fd, &st) == 0 ? st.st_size : 0,
+                   &src_len);
+    if (fd >= 0)
+        close(fd);
+    if (!src)
+    {
+        fprintf(stderr, "%s:0.0: cannot open file: %s\n", filename, filename);
+        return false;
+    }
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *) addr, sizeof(*addr)))
+    {
+        perror(addr->sun_path);
+        exit(1);
+    }
+    if (!write_all(sock, src, src_len) || shutdown(sock, SHUT_WR) != 0
+        || !(resp = read_all(sock, SIZE_MAX, 0, &resp_len)))
+    {
+        fprintf(stderr, "%s: request failed\n", filename);
+        exit(1);
+    }
+    close(sock);
+    free(src);
+
+    ok = print_answer(filename, resp, resp_len);
+    free(resp);
+    return ok;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+bool srv_request(string_t path, string_t *filenames, int count, bool stats)
+{
+    struct sockaddr_un addr;
+    double *times;
+    bool ok = true;
+    int i;
+
+    if (!unix_address(&addr, path))
+        return false;
+    times = checked_malloc(count * sizeof(*times));
+    for (i = 0; i < count; i++)
+    {
+        double start = now();
+        if (!request(&addr, filenames[i]))
+            ok = false;
+        times[i] = now() - start;
+    }
+    if (stats)
+    {
+        qsort(times, count, sizeof(*times), compare_doubles);
+        fprintf(stderr, "serve: %d requests, p50 %.3fms, p99 %.3fms\n",
+                count, times[count / 2] * 1e3,
+                times[(count * 99 - 1) / 100] * 1e3);
+    }
+    free(times);
+    return ok;
+}
@@ -0,0 +1,17 @@
+#ifndef INCLUDE__SERVER_H
+#define INCLUDE__SERVER_H
+
+#include "utils.h"
+
+/* Serve compile requests on the Unix socket at path with jobs threads,
+ * each keeping its symbols and base environment between requests.  With
+ * check_only, requests are only type-checked, and each thread re-checks
+ * incrementally against the last source it checked.  Only returns if the
+ * socket cannot be set up. */
+int srv_serve(string_t path, int jobs, bool check_only);
+
+/* Have the server at path compile each file, printing the results as the
+ * compiler itself would; with stats, also report request latencies. */
+bool srv_request(string_t path, string_t *filenames, int count, bool stats);
+
+#endif
@@ -4,77 +4,259 @@
 
 #include "symbol.h"
 
-static symbol_t _symbols[HT_SIZE];
+struct symbol_s
+{
+    string_t name;
+    int id;
+};
 
-static symbol_t mk_symbol(string_t name, symbol_t next)
+/* Open-addressed intern table.  Each slot keeps the symbol's hash and
+ * length so that probing rarely touches the names, which are packed into
+ * the chunks of a string pool together with the symbols themselves. */
+typedef struct sym_slot_s sym_slot_t;
+struct sym_slot_s
 {
-    symbol_t sym = checked_malloc(sizeof(*sym));
-    sym->data = name;
-    sym->next = next;
+    unsigned int hash;
+    int len;
+    symbol_t sym;
+};
+
+#define SYM_INIT_CAP 1024
+
+static THREAD_LOCAL sym_slot_t *_slots = NULL;
+static THREAD_LOCAL int _slot_cap = 0;
+static THREAD_LOCAL int _slot_count = 0;
+static THREAD_LOCAL arena_t _pool = NULL;
+/* Symbols up to _kept_count live in _kept and survive sym_reset. */
+static THREAD_LOCAL int _kept_count = 0;
+static THREAD_LOCAL arena_t _kept = NULL;
+
+static symbol_t mk_symbol(const char *name, int len)
+{
+    symbol_t sym = arena_alloc(_pool, sizeof(*sym));
+
+    /* Own a copy: the caller's text usually lives in the scanner's buffer
+     * or a compilation unit's arena, while symbols outlive both. */
+    sym->name = arena_string(_pool, name, len);
+    sym->id = _slot_count;
     return sym;
 }
 
-static unsigned int hash(string_t str)
+static unsigned int hash(const char *str, int len)
 {
     unsigned int h = 0;
-    char *p;
+    const char *p;
 
-    for (p = str; *p; p++)
+    for (p = str; p < str + len; p++)
         h = 65599 * h + *p;
     return h;
 }
 
+/* Move the symbols numbered below _slot_count into a table of cap slots. */
+static void rehash(int cap)
+{
+    sym_slot_t *old = _slots;
+    int old_cap = _slot_cap, i;
+
+    _slot_cap = cap;
+    _slots = checked_malloc(_slot_cap * sizeof(*_slots));
+    for (i = 0; i < _slot_cap; i++)
+        _slots[i].sym = NULL;
+    for (i = 0; i < old_cap; i++)
+    {
+        int j = old[i].hash & (_slot_cap - 1);
+        if (!old[i].sym || old[i].sym->id >= _slot_count)
+            continue;
+        while (_slots[j].sym)
+            j = (j + 1) & (_slot_cap - 1);
+        _slots[j] = old[i];
+    }
+    free(old);
+}
+
 symbol_t symbol(string_t name)
 {
-    int index = hash(name) % HT_SIZE;
-    symbol_t p;
+    return sym_intern(name, strlen(name));
+}
 
-    for (p = _symbols[index]; p; p = p->next)
-        if (strcmp((string_t) p->data, name) == 0)
-            return p;
-    p = mk_symbol(name, _symbols[index]);
-    _symbols[index] = p;
-    return p;
+symbol_t sym_intern(const char *name, int len)
+{
+    unsigned int h = hash(name, len);
+    int i;
+
+    /* Keep the load factor under 3/4. */
+    if (4 * (_slot_count + 1) > 3 * _slot_cap)
+    {
+        if (!_pool)
+            _pool = arena_new();
+        rehash(_slot_cap ? _slot_cap * 2 : SYM_INIT_CAP);
+    }
+
+    for (i = h & (_slot_cap - 1);
+         _slots[i].sym;
+         i = (i + 1) & (_slot_cap - 1))
+    {
+        sym_slot_t *slot = &_slots[i];
+        if (slot->hash == h && slot->len == len
+            && memcmp(slot->sym->name, name, len) == 0)
+            return slot->sym;
+    }
+    _slots[i].hash = h;
+    _slots[i].len = len;
+    _slots[i].sym = mk_symbol(name, len);
+    _slot_count++;
+    return _slots[i].sym;
 }
 
 string_t sym_name(symbol_t sym)
 {
-    return (string_t) sym->data;
+    return sym->name;
+}
+
+void sym_keep(void)
+{
+    if (_pool)
+    {
+        if (!_kept)
+            _kept = arena_new();
+        arena_adopt(_kept, _pool);
+        _pool = arena_new();
+    }
+    _kept_count = _slot_count;
 }
 
-table_t sym_empty(void)
+/* The table shrinks back to what the kept symbols need, so that one big
+ * unit does not leave every later one probing a table sized for it. */
+void sym_reset(void)
 {
-    return tab_empty();
+    int cap = SYM_INIT_CAP;
+
+    if (_slot_count == _kept_count)
+        return;
+    _slot_count = _kept_count;
+    while (4 * (_slot_count + 1) > 3 * cap)
+        cap *= 2;
+    rehash(cap);
+    arena_reset(_pool);
 }
 
-void sym_enter(table_t tab, symbol_t sym, void *value)
+/* A scoped table holds the current binding of every symbol in an array
+ * indexed by the symbol's id.  Entering a binding saves the one it
+ * shadows on an undo log, and ending a scope replays the log back to the
+ * scope's mark, so neither costs an allocation once the arrays are big
+ * enough. */
+#define SYM_SCOPE_MARK (-1)
+
+typedef struct sym_undo_s sym_undo_t;
+struct sym_undo_s
+{
+    int id;
+    void *value;
+};
+
+struct sym_table_s
 {
-    tab_enter(tab, sym, value);
+    void **values;
+    int value_cap;
+    sym_undo_t *undo;
+    int undo_len;
+    int undo_cap;
+};
+
+sym_table_t sym_empty(void)
+{
+    sym_table_t p = checked_malloc(sizeof(*p));
+    p->values = NULL;
+    p->value_cap = 0;
+    p->undo = NULL;
+    p->undo_len = 0;
+    p->undo_cap = 0;
+    return p;
 }
 
-void *sym_lookup(table_t tab, symbol_t sym)
+void sym_free(sym_table_t tab)
 {
-    return tab_lookup(tab, sym);
+    free(tab->values);
+    free(tab->undo);
+    free(tab);
 }
 
-static symbol_t _mark_sym = NULL;
+static void push_undo(sym_table_t tab, int id, void *value)
+{
+    if (tab->undo_len == tab->undo_cap)
+    {
+        sym_undo_t *p;
 
-void sym_begin_scope(table_t tab)
+        tab->undo_cap = tab->undo_cap ? tab->undo_cap * 2 : 64;
+        p = checked_malloc(tab->undo_cap * sizeof(*p));
+        if (tab->undo)
+        {
+            memcpy(p, tab->undo, tab->undo_len * sizeof(*p));
+            free(tab->undo);
+        }
+        tab->undo = p;
+    }
+    tab->undo[tab->undo_len].id = id;
+    tab->undo[tab->undo_len].value = value;
+    tab->undo_len++;
+}
+
+void sym_enter(sym_table_t tab, symbol_t sym, void *value)
 {
-    if (!_mark_sym)
+    assert(tab && sym);
+    if (sym->id >= tab->value_cap)
     {
-        _mark_sym = checked_malloc(sizeof(*_mark_sym));
-        _mark_sym->data = "<mark>";
-        _mark_sym->next = NULL;
+        int cap = tab->value_cap ? tab->value_cap : 256, i;
+        void **p;
+
+        while (cap <= sym->id || cap < _slot_count)
+            cap *= 2;
+        p = checked_malloc(cap * sizeof(*p));
+        for (i = 0; i < cap; i++)
+            p[i] = i < tab->value_cap ? tab->values[i] : NULL;
+        free(tab->values);
+        tab->values = p;
+        tab->value_cap = cap;
     }
-    sym_enter(tab, _mark_sym, NULL);
+    push_undo(tab, sym->id, tab->values[sym->id]);
+    tab->values[sym->id] = value;
 }
 
-void sym_end_scope(table_t tab)
+void *sym_lookup(sym_table_t tab, symbol_t sym)
 {
-    symbol_t sym;
+    assert(tab && sym);
+    return sym->id < tab->value_cap ? tab->values[sym->id] : NULL;
+}
+
+void sym_begin_scope(sym_table_t tab)
+{
+    push_undo(tab, SYM_SCOPE_MARK, NULL);
+}
+
+void sym_end_scope(sym_table_t tab)
+{
+    sym_undo_t *undo;
 
     do
-        sym = tab_pop(tab);
-    while (sym != _mark_sym);
+    {
+        assert(tab->undo_len > 0);
+        undo = &tab->undo[--tab->undo_len];
+        if (undo->id != SYM_SCOPE_MARK)
+            tab->values[undo->id] = undo->value;
+    }
+    while (undo->id != SYM_SCOPE_MARK);
+}
+
+void sym_copy(sym_table_t dst, sym_table_t src)
+{
+    if (dst->value_cap < src->value_cap)
+    {
+        free(dst->values);
+        dst->values = checked_malloc(src->value_cap * sizeof(*dst->values));
+        dst->value_cap = src->value_cap;
+    }
+    memcpy(dst->values, src->values, src->value_cap * sizeof(*dst->values));
+    memset(dst->values + src->value_cap, 0,
+           (dst->value_cap - src->value_cap) * sizeof(*dst->values));
+    dst->undo_len = 0;
 }
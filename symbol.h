@@ -1,17 +1,27 @@
 #ifndef INCLUDE__SYMBOL_H
 #define INCLUDE__SYMBOL_H
 
-#include "table.h"
 #include "utils.h"
 
-typedef list_t symbol_t;
+typedef struct symbol_s *symbol_t;
+typedef struct sym_table_s *sym_table_t;
 
 symbol_t symbol(string_t name);
+/* Intern len bytes at name, which need not be NUL-terminated. */
+symbol_t sym_intern(const char *name, int len);
 string_t sym_name(symbol_t sym);
-table_t sym_empty(void);
-void sym_enter(table_t tab, symbol_t sym, void *value);
-void *sym_lookup(table_t tab, symbol_t sym);
-void sym_begin_scope(table_t tab);
-void sym_end_scope(table_t tab);
+/* Keep the symbols interned so far through later resets. */
+void sym_keep(void);
+/* Forget every symbol interned since the last sym_keep, for a new
+ * compilation unit; nothing may refer to them any more. */
+void sym_reset(void);
+sym_table_t sym_empty(void);
+void sym_free(sym_table_t tab);
+void sym_enter(sym_table_t tab, symbol_t sym, void *value);
+void *sym_lookup(sym_table_t tab, symbol_t sym);
+void sym_begin_scope(sym_table_t tab);
+void sym_end_scope(sym_table_t tab);
+/* Bind in dst what src binds now, with no scope open in dst. */
+void sym_copy(sym_table_t dst, sym_table_t src);
 
 #endif
@@ -1,82 +1,134 @@
 #include <assert.h>
-#include <stdint.h>
 #include <stdlib.h>
 
 #include "table.h"
 #include "utils.h"
 
+/* Tables start with a handful of buckets and double whenever they hold
+ * more bindings than buckets, so the many small maps cost little to set
+ * up while big ones keep short chains. */
+#define TAB_INIT_SIZE 8
+
 typedef struct binder_s *binder_t;
 struct binder_s
 {
     void *key;
     void *value;
+    binder_t next;
     binder_t prev;
 };
 
 struct table_s
 {
-    list_t table[HT_SIZE];
+    binder_t *table;
+    int size;
+    int count;
     binder_t top;
 };
 
-static binder_t binder(void *key, void *value, binder_t prev)
+static binder_t binder(void *key, void *value, binder_t next, binder_t prev)
 {
-    binder_t p = checked_malloc(sizeof(*p));
+    binder_t p = slab_alloc(ALLOC_BINDER, sizeof(*p));
     p->key = key;
     p->value = value;
+    p->next = next;
     p->prev = prev;
     return p;
 }
 
+static binder_t *empty_buckets(int size)
+{
+    binder_t *p = checked_malloc(size * sizeof(*p));
+    int i;
+
+    for (i = 0; i < size; i++)
+        p[i] = NULL;
+    return p;
+}
+
 table_t tab_empty(void)
 {
     table_t p = checked_malloc(sizeof(*p));
-    int i;
 
+    p->table = NULL;
+    p->size = 0;
+    p->count = 0;
     p->top = NULL;
-    for (i = 0; i < HT_SIZE; i++)
-        p->table[i] = NULL;
     return p;
 }
 
+static void grow(table_t tab)
+{
+    binder_t *old = tab->table;
+    int old_size = tab->size, i;
+
+    tab->size = old_size ? old_size * 2 : TAB_INIT_SIZE;
+    tab->table = empty_buckets(tab->size);
+    /* Move each chain's binders newest first onto the tail of their new
+     * chains, so a key's newest binding stays in front of those it
+     * shadows. */
+    for (i = 0; i < old_size; i++)
+    {
+        binder_t bind = old[i];
+        while (bind)
+        {
+            binder_t next = bind->next;
+            binder_t *p = &tab->table[ptr_hash(bind->key) & (tab->size - 1)];
+
+            while (*p)
+                p = &(*p)->next;
+            bind->next = NULL;
+            *p = bind;
+            bind = next;
+        }
+    }
+    free(old);
+}
+
 void tab_enter(table_t tab, void *key, void *value)
 {
     int index;
 
     assert(tab && key);
-    index = ((intptr_t) key) % HT_SIZE;
-    tab->table[index] = list(binder(key, value, tab->top), tab->table[index]);
-    tab->top = tab->table[index]->data;
+    if (tab->count >= tab->size)
+        grow(tab);
+    index = ptr_hash(key) & (tab->size - 1);
+    tab->table[index] = binder(key, value, tab->table[index], tab->top);
+    tab->top = tab->table[index];
+    tab->count++;
 }
 
 void *tab_lookup(table_t tab, void *key)
 {
-    int index;
-    list_t p;
+    binder_t bind;
 
     assert(tab && key);
-    index = ((intptr_t) key) % HT_SIZE;
-    for (p = tab->table[index]; p; p = p->next)
-        if (((binder_t) p->data)->key == key)
-            return ((binder_t) p->data)->value;
+    if (!tab->size)
+        return NULL;
+    bind = tab->table[ptr_hash(key) & (tab->size - 1)];
+    for (; bind; bind = bind->next)
+        if (bind->key == key)
+            return bind->value;
     return NULL;
 }
 
 void *tab_pop(table_t tab)
 {
     binder_t bind;
-    list_t p;
+    void *key;
     int index;
 
     assert(tab);
     bind = tab->top;
     assert(bind);
-    index = ((intptr_t) bind->key) % HT_SIZE;
-    p = tab->table[index];
-    assert(p);
-    tab->table[index] = p->next;
+    index = ptr_hash(bind->key) & (tab->size - 1);
+    assert(tab->table[index] == bind);
+    tab->table[index] = bind->next;
     tab->top = bind->prev;
-    return bind->key;
+    tab->count--;
+    key = bind->key;
+    slab_free(bind, sizeof(*bind));
+    return key;
 }
 
 void tab_dump(table_t tab, tab_dump_func_t show)
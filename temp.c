@@ -1,112 +1,294 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "temp.h"
 
-struct temp_s
+string_t tmp_name(tmp_label_t label)
 {
-    int num;
+    return sym_name(label);
+}
+
+static THREAD_LOCAL int _labels = 0;
+static THREAD_LOCAL int _label_base = 0;
+static THREAD_LOCAL int _temps = 100;
+static THREAD_LOCAL tmp_map_t _map = NULL;
+
+/* A task logs the name of each label it makes, NULL for a fresh one, and
+ * the maker of each temp, NULL for a plain one.  Merging fills in the
+ * real labels and temps. */
+struct tmp_task_s
+{
+    string_t *labels;
+    tmp_label_t *label_map;
+    int label_count;
+    int label_cap;
+    temp_t (**temps)(void);
+    temp_t *temp_map;
+    int temp_count;
+    int temp_cap;
 };
 
-string_t tmp_name(tmp_label_t label)
+static THREAD_LOCAL tmp_task_t _task = NULL;
+
+/* Placeholders are interned on the worker, which keeps reusing them, and
+ * spelled so that no real label is mistaken for one. */
+static tmp_label_t task_label(string_t name)
 {
-    return sym_name(label);
+    char buf[16];
+
+    if (_task->label_count == _task->label_cap)
+        _task->labels = grow_array(_task->labels, _task->label_count,
+                                   &_task->label_cap, sizeof(*_task->labels));
+    _task->labels[_task->label_count] = name;
+    snprintf(buf, sizeof(buf), "~L%d", _task->label_count++);
+    return symbol(buf);
 }
 
-static int _labels = 0;
+static temp_t task_temp(temp_t (*make)(void))
+{
+    if (_task->temp_count == _task->temp_cap)
+        _task->temps = grow_array(_task->temps, _task->temp_count,
+                                  &_task->temp_cap, sizeof(*_task->temps));
+    _task->temps[_task->temp_count] = make;
+    return TMP_TASK_BASE + _task->temp_count++;
+}
 
 tmp_label_t tmp_label(void)
 {
     char buf[16];
+
+    if (_task)
+        return task_label(NULL);
     snprintf(buf, sizeof(buf), ".L%d", _labels++);
-    return tmp_named_label(string(buf));
+    return symbol(buf);
 }
 
 tmp_label_t tmp_named_label(string_t str)
 {
+    if (_task)
+        return task_label(str);
     return symbol(str);
 }
 
-static int _temps = 100;
-
 temp_t temp(void)
 {
-    temp_t p = checked_malloc(sizeof(*p));
-    p->num = _temps++;
-    {
-        char buf[16];
-        snprintf(buf, sizeof(buf), "%d", p->num);
-        tmp_enter(tmp_map(), p, string(buf));
-    }
-    return p;
+    if (_task)
+        return task_temp(NULL);
+    return _temps++;
+}
+
+void tmp_begin_task(void)
+{
+    assert(!_task);
+    _task = checked_malloc(sizeof(*_task));
+    _task->labels = NULL;
+    _task->label_map = NULL;
+    _task->label_count = _task->label_cap = 0;
+    _task->temps = NULL;
+    _task->temp_map = NULL;
+    _task->temp_count = _task->temp_cap = 0;
+}
+
+tmp_task_t tmp_end_task(void)
+{
+    tmp_task_t task = _task;
+
+    assert(task);
+    _task = NULL;
+    return task;
+}
+
+bool tmp_in_task(void)
+{
+    return _task != NULL;
+}
+
+temp_t tmp_deferred(temp_t (*make)(void))
+{
+    assert(_task);
+    return task_temp(make);
+}
+
+void tmp_merge_task(tmp_task_t task)
+{
+    int i;
+
+    assert(!_task);
+    task->label_map = checked_malloc(
+        (task->label_count ? task->label_count : 1) * sizeof(tmp_label_t));
+    for (i = 0; i < task->label_count; i++)
+        task->label_map[i] = task->labels[i]
+            ? tmp_named_label(task->labels[i]) : tmp_label();
+    task->temp_map = checked_malloc(
+        (task->temp_count ? task->temp_count : 1) * sizeof(temp_t));
+    for (i = 0; i < task->temp_count; i++)
+        task->temp_map[i] = task->temps[i] ? task->temps[i]() : temp();
+}
+
+temp_t tmp_relocate(tmp_task_t task, temp_t tmp)
+{
+    if (tmp < TMP_TASK_BASE)
+        return tmp;
+    assert(tmp - TMP_TASK_BASE < task->temp_count);
+    return task->temp_map[tmp - TMP_TASK_BASE];
+}
+
+tmp_label_t tmp_relocate_label(tmp_task_t task, tmp_label_t label)
+{
+    string_t name;
+
+    if (!label)
+        return NULL;
+    name = sym_name(label);
+    if (name[0] != '~')
+        return label;
+    assert(atoi(name + 2) < task->label_count);
+    return task->label_map[atoi(name + 2)];
+}
+
+void tmp_free_task(tmp_task_t task)
+{
+    free(task->labels);
+    free(task->label_map);
+    free(task->temps);
+    free(task->temp_map);
+    free(task);
 }
 
+static void free_map(tmp_map_t map);
+
+void tmp_reset(void)
+{
+    _labels = _label_base;
+    _temps = 100;
+    if (_map)
+        free_map(_map);
+    _map = NULL;
+}
+
+void tmp_keep_labels(void)
+{
+    _label_base = _labels;
+}
+
+/* A map is a flat array of names indexed by temp number.  The array may be
+ * shared by several maps, as layering does, and is copied by the first
+ * write through any of them. */
+typedef struct tmp_names_s *tmp_names_t;
+struct tmp_names_s
+{
+    string_t *names;
+    int cap;
+    int refs;
+};
+
 struct tmp_map_s
 {
-    table_t table;
-    tmp_map_t under;
+    tmp_names_t names;
 };
 
 tmp_map_t tmp_map(void)
 {
-    static tmp_map_t map = NULL;
-    if (!map)
-        map = tmp_empty();
-    return map;
+    if (!_map)
+        _map = tmp_empty();
+    return _map;
+}
+
+static tmp_names_t new_names(tmp_names_t from, int cap)
+{
+    tmp_names_t p = checked_malloc(sizeof(*p));
+    int i = 0;
+
+    p->names = checked_malloc(cap * sizeof(*p->names));
+    p->cap = cap;
+    p->refs = 1;
+    if (from)
+    {
+        memcpy(p->names, from->names, from->cap * sizeof(*p->names));
+        i = from->cap;
+    }
+    for (; i < cap; i++)
+        p->names[i] = NULL;
+    return p;
 }
 
-static tmp_map_t new_map(table_t tab, tmp_map_t under)
+static tmp_map_t new_map(tmp_names_t names)
 {
     tmp_map_t p = checked_malloc(sizeof(*p));
-    p->table = tab;
-    p->under = under;
+    p->names = names;
     return p;
 }
 
+static void free_map(tmp_map_t map)
+{
+    if (--map->names->refs == 0)
+    {
+        free(map->names->names);
+        free(map->names);
+    }
+    free(map);
+}
+
 tmp_map_t tmp_empty(void)
 {
-    return new_map(tab_empty(), NULL);
+    return new_map(new_names(NULL, _temps));
 }
 
 tmp_map_t tmp_layer_map(tmp_map_t over, tmp_map_t under)
 {
+    tmp_map_t p;
+    int i;
+
     if (over == NULL)
         return under;
-    else
-        return new_map(over->table, tmp_layer_map(over->under, under));
+    p = new_map(under->names);
+    under->names->refs++;
+    for (i = 0; i < over->names->cap; i++)
+        if (over->names->names[i])
+            tmp_enter(p, i, over->names->names[i]);
+    return p;
 }
 
 void tmp_enter(tmp_map_t map, temp_t tmp, string_t str)
 {
-    assert(map && map->table);
-    tab_enter(map->table, tmp, str);
+    tmp_names_t names;
+
+    assert(map && map->names && tmp >= 0);
+    names = map->names;
+    if (names->refs > 1 || tmp >= names->cap)
+    {
+        int cap = names->cap ? names->cap : 1;
+
+        while (cap <= tmp || cap < _temps)
+            cap *= 2;
+        names->refs--;
+        if (names->refs == 0)
+        {
+            map->names = new_names(names, cap);
+            free(names->names);
+            free(names);
+        }
+        else
+            map->names = new_names(names, cap);
+    }
+    map->names->names[tmp] = str;
 }
 
 string_t tmp_lookup(tmp_map_t map, temp_t tmp)
 {
-    string_t str;
-
-    assert(map && map->table);
-    str = tab_lookup(map->table, tmp);
-    if (str)
-        return str;
-    else if (map->under)
-        return tmp_lookup(map->under, tmp);
+    assert(map && map->names);
+    if (tmp >= 0 && tmp < map->names->cap)
+        return map->names->names[tmp];
     else
         return NULL;
 }
 
-static FILE *_fp;
-
-static void show(temp_t tmp, string_t str)
-{
-    fprintf(_fp, "t%d ->%s\n", tmp->num, str);
-}
-
 void tmp_dump_map(FILE *fp, tmp_map_t map)
 {
-    _fp = fp;
-    tab_dump(map->table, (tab_dump_func_t) show);
-    if (map->under)
-    {
-        fprintf(fp, "-------\n");
-        tmp_dump_map(fp, map->under);
-    }
+    int i;
+
+    for (i = 0; i < map->names->cap; i++)
+        if (map->names->names[i])
+            fprintf(fp, "t%d ->%s\n", i, map->names->names[i]);
 }
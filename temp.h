@@ -6,7 +6,8 @@
 #include "symbol.h"
 #include "utils.h"
 
-typedef struct temp_s *temp_t;
+/* Temps are numbered densely from 100 up; 0 is never a temp. */
+typedef int temp_t;
 temp_t temp(void);
 
 typedef symbol_t tmp_label_t;
@@ -23,4 +24,29 @@ void tmp_dump_map(FILE *fp, tmp_map_t map);
 
 tmp_map_t tmp_map(void);
 
+/* A task is a piece of a unit run on a worker thread beside others, such
+ * as one function body of a declaration group.  Its temps and labels are
+ * numbered on their own, temps from TMP_TASK_BASE up and labels as
+ * placeholders, and logged in order.  Merging the task on the unit's own
+ * thread then makes the real temps and labels in that order, so they are
+ * numbered just as if the task had run there, and relocation rewrites the
+ * task's temps and labels to them. */
+#define TMP_TASK_BASE (1 << 28)
+typedef struct tmp_task_s *tmp_task_t;
+void tmp_begin_task(void);
+tmp_task_t tmp_end_task(void);
+bool tmp_in_task(void);
+/* Stand in for a temp made by make, which the merge calls in its place.
+ * For the unit's fixed registers, made by whoever first needs them. */
+temp_t tmp_deferred(temp_t (*make)(void));
+void tmp_merge_task(tmp_task_t task);
+temp_t tmp_relocate(tmp_task_t task, temp_t tmp);
+tmp_label_t tmp_relocate_label(tmp_task_t task, tmp_label_t label);
+void tmp_free_task(tmp_task_t task);
+
+/* Restart label and temp numbering for a new compilation unit. */
+void tmp_reset(void);
+/* Keep the labels made so far out of the numbering of later units. */
+void tmp_keep_labels(void);
+
 #endif
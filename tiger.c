@@ -0,0 +1,376 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "errmsg.h"
+#include "escape.h"
+#include "frame.h"
+#include "lift.h"
+#include "parser-wrap.h"
+#include "semantic.h"
+#include "temp.h"
+#include "tiger.h"
+#include "translate.h"
+
+struct tiger_ctx_s
+{
+    /* Holds the tree, and in its arena the diagnostics' messages;
+     * fragments point into it too, for their strings. */
+    ast_store_t tree;
+    /* Holds everything else a request allocates, the fragments among it,
+     * until the next request. */
+    arena_t unit;
+    char *out;
+    size_t out_len;
+    tiger_diag_t *diags;
+    int diag_count;
+    int diag_cap;
+    list_t string_frags;
+    list_t proc_frags;
+    /* The source and tree of the last check, when it parsed, so that the
+     * next check can re-parse just the function body an edit falls in.
+     * waste counts what such checks have left behind in the arena. */
+    char *src;
+    size_t src_len;
+    ast_expr_t prog;
+    ast_func_t *funcs;
+    int func_count;
+    int func_cap;
+    size_t waste;
+    /* Which thread's compilation the tree belongs to. */
+    const unsigned long *thread;
+    unsigned long serial;
+};
+
+/* Every compilation from scratch forgets the symbols that the last one on
+ * its thread interned, so a tree is good for rechecks only as long as no
+ * other compilation has run on the thread since.  _serial counts them,
+ * and its address tells the threads apart. */
+static THREAD_LOCAL unsigned long _serial = 0;
+
+tiger_ctx_t tiger_ctx_new(void)
+{
+    tiger_ctx_t p = checked_malloc(sizeof(*p));
+    p->tree = ast_store_new();
+    p->unit = arena_new();
+    p->out = NULL;
+    p->out_len = 0;
+    p->diags = NULL;
+    p->diag_count = 0;
+    p->diag_cap = 0;
+    p->string_frags = NULL;
+    p->proc_frags = NULL;
+    p->src = NULL;
+    p->src_len = 0;
+    p->prog = 0;
+    p->funcs = NULL;
+    p->func_count = 0;
+    p->func_cap = 0;
+    p->waste = 0;
+    p->thread = NULL;
+    p->serial = 0;
+    return p;
+}
+
+static void clear_results(tiger_ctx_t ctx)
+{
+    free(ctx->out);
+    ctx->out = NULL;
+    ctx->out_len = 0;
+    ctx->diag_count = 0;
+    ctx->string_frags = NULL;
+    ctx->proc_frags = NULL;
+    arena_reset(ctx->unit);
+}
+
+static void clear(tiger_ctx_t ctx)
+{
+    clear_results(ctx);
+    ast_store_reset(ctx->tree);
+    ctx->prog = 0;
+    ctx->func_count = 0;
+}
+
+void tiger_ctx_free(tiger_ctx_t ctx)
+{
+    clear(ctx);
+    ast_store_free(ctx->tree);
+    arena_free(ctx->unit);
+    free(ctx->diags);
+    free(ctx->src);
+    free(ctx->funcs);
+    free(ctx);
+}
+
+static void add_diag(void *data, int line, int column, string_t msg)
+{
+    tiger_ctx_t ctx = data;
+    tiger_diag_t *diag;
+
+    if (ctx->diag_count == ctx->diag_cap)
+    {
+        tiger_diag_t *p;
+
+        ctx->diag_cap = ctx->diag_cap ? ctx->diag_cap * 2 : 16;
+        p = checked_malloc(ctx->diag_cap * sizeof(*p));
+        if (ctx->diags)
+        {
+            memcpy(p, ctx->diags, ctx->diag_count * sizeof(*p));
+            free(ctx->diags);
+        }
+        ctx->diags = p;
+    }
+    diag = &ctx->diags[ctx->diag_count++];
+    diag->line = line;
+    diag->column = column;
+    diag->message = arena_string(ast_store_arena(ctx->tree), msg, strlen(msg));
+    ctx->waste += strlen(msg) + 1;
+}
+
+static void ignore_diag(void *data, int line, int column, string_t msg)
+{
+}
+
+static void add_func(tiger_ctx_t ctx, ast_func_t func)
+{
+    if (ctx->func_count == ctx->func_cap)
+    {
+        ast_func_t *p;
+
+        ctx->func_cap = ctx->func_cap ? ctx->func_cap * 2 : 64;
+        p = checked_malloc(ctx->func_cap * sizeof(*p));
+        if (ctx->funcs)
+        {
+            memcpy(p, ctx->funcs, ctx->func_count * sizeof(*p));
+            free(ctx->funcs);
+        }
+        ctx->funcs = p;
+    }
+    ctx->funcs[ctx->func_count++] = func;
+}
+
+static void keep_source(tiger_ctx_t ctx, const char *ptr, size_t len)
+{
+    free(ctx->src);
+    ctx->src = checked_malloc(len ? len : 1);
+    memcpy(ctx->src, ptr, len);
+    ctx->src_len = len;
+}
+
+static void keep_tree(tiger_ctx_t ctx, const char *ptr, size_t len,
+                      ast_expr_t prog)
+{
+    list_t p;
+
+    keep_source(ctx, ptr, len);
+    ctx->prog = prog;
+    ctx->func_count = 0;
+    for (p = ast_funcs(); p; p = p->next)
+        add_func(ctx, p->data);
+    ctx->waste = 0;
+    ctx->thread = &_serial;
+    ctx->serial = _serial;
+}
+
+/* Replace the body of func, the innermost function whose body holds the
+ * text from start up to end, with body, which stands for that text after
+ * it grew by delta. */
+static void replace_body(tiger_ctx_t ctx, ast_func_t func, ast_expr_t body,
+                         int start, int end, int delta)
+{
+    list_t p;
+    int i, j;
+
+    /* The functions whose bodies hold the edit must be checked again;
+     * those nested in the old body are gone. */
+    for (i = j = 0; i < ctx->func_count; i++)
+    {
+        ast_func_t f = ctx->funcs[i];
+
+        if (f->body_start <= start && end < f->body_end)
+            f->checked = false;
+        if (f != func && func->body_start <= f->body_start
+            && f->body_end <= func->body_end)
+            continue;
+        ctx->funcs[j++] = f;
+    }
+    ctx->func_count = j;
+
+    ast_shift(end, delta);
+    func->body = body;
+    for (p = ast_funcs(); p; p = p->next)
+        add_func(ctx, p->data);
+}
+
+#define CMP_BLOCK 4096
+
+/* Check ptr against the tree of the last check when the two differ only
+ * within one function body, re-parsing that body alone; false if a full
+ * check is needed instead. */
+static bool recheck(tiger_ctx_t ctx, const char *ptr, size_t len, bool *ok)
+{
+    size_t prefix = 0, suffix = 0, common;
+    ast_func_t func = NULL;
+    int start, end, delta, i;
+
+    if (!ctx->prog || ctx->thread != &_serial || ctx->serial != _serial
+        || len > INT_MAX)
+        return false;
+    /* Skip what matches a block at a time with memcmp, then find the
+     * first difference within the block. */
+    common = len < ctx->src_len ? len : ctx->src_len;
+    while (common - prefix >= CMP_BLOCK
+           && memcmp(ptr + prefix, ctx->src + prefix, CMP_BLOCK) == 0)
+        prefix += CMP_BLOCK;
+    while (prefix < common && ptr[prefix] == ctx->src[prefix])
+        prefix++;
+    while (common - prefix - suffix >= CMP_BLOCK
+           && memcmp(ptr + len - suffix - CMP_BLOCK,
+                     ctx->src + ctx->src_len - suffix - CMP_BLOCK,
+                     CMP_BLOCK) == 0)
+        suffix += CMP_BLOCK;
+    while (suffix < common - prefix
+           && ptr[len - 1 - suffix] == ctx->src[ctx->src_len - 1 - suffix])
+        suffix++;
+
+    /* Positions count from 1: the edit replaced the text from start up to
+     * end, and the text after it moved by delta. */
+    start = prefix + 1;
+    end = ctx->src_len - suffix + 1;
+    delta = (int) len - (int) ctx->src_len;
+
+    if (len != ctx->src_len || prefix < len)
+    {
+        ast_expr_t body;
+        int body_len;
+
+        /* Some unchanged text must separate the edit from the token that
+         * ends the body, or the two might now scan as one. */
+        for (i = 0; i < ctx->func_count; i++)
+        {
+            ast_func_t f = ctx->funcs[i];
+
+            if (f->body_start <= start && end < f->body_end
+                && (!func || f->body_end - f->body_start
+                             < func->body_end - func->body_start))
+                func = f;
+        }
+        if (!func)
+            return false;
+        body_len = func->body_end + delta - func->body_start;
+        if (ctx->waste + body_len > len)
+            return false;
+
+        em_set_handler(ignore_diag, NULL);
+        em_reset_buffer("", ptr, len);
+        body = parse_fragment(ptr, func->body_start, body_len, ctx->tree);
+        em_set_handler(NULL, NULL);
+        if (!body || em_any_errors)
+            return false;
+
+        replace_body(ctx, func, body, start, end, delta);
+        keep_source(ctx, ptr, len);
+        ctx->waste += body_len;
+    }
+
+    em_set_handler(add_diag, ctx);
+    em_reset_buffer("", ctx->src, len);
+    /* The diagnostics kept with the bodies go with the tree. */
+    ast_set_store(ctx->tree);
+    *ok = sem_check_prog(ctx->prog);
+    em_set_handler(NULL, NULL);
+    return true;
+}
+static bool compile(tiger_ctx_t ctx, const char *ptr, size_t len,
+                    bool check_only)
+{
+    ast_expr_t prog;
+    bool ok = false;
+
+    clear(ctx);
+    tmp_reset();
+    tr_reset();
+    fr_reset();
+    sem_reset();
+    _serial++;
+    em_set_handler(add_diag, ctx);
+
+    if (len > INT_MAX)
+    {
+        em_reset_buffer("", ptr, 0);
+        em_error(0, "source too large");
+        em_set_handler(NULL, NULL);
+        return false;
+    }
+
+    prog = parse_buffer("", ptr, len, ctx->tree);
+    if (prog && !em_any_errors && check_only)
+    {
+        keep_tree(ctx, ptr, len, prog);
+        ok = sem_check_prog(prog);
+    }
+    else if (prog && !em_any_errors)
+    {
+        FILE *out = open_memstream(&ctx->out, &ctx->out_len);
+
+        assert(out);
+        esc_find_escape(prog);
+        if (lift_enabled)
+            lift_funcs(prog);
+        ok = sem_trans_prog(prog, out);
+        fclose(out);
+    }
+    em_set_handler(NULL, NULL);
+
+    ctx->string_frags = fr_string_frags();
+    ctx->proc_frags = fr_proc_frags();
+    return ok;
+}
+
+bool tiger_compile_buffer(tiger_ctx_t ctx, const char *ptr, size_t len)
+{
+    arena_t unit;
+    bool ok;
+
+    clear_results(ctx);
+    unit = unit_set_arena(ctx->unit);
+    ok = compile(ctx, ptr, len, false);
+    unit_set_arena(unit);
+    return ok;
+}
+
+bool tiger_check_buffer(tiger_ctx_t ctx, const char *ptr, size_t len)
+{
+    arena_t unit;
+    bool ok;
+
+    clear_results(ctx);
+    unit = unit_set_arena(ctx->unit);
+    if (!recheck(ctx, ptr, len, &ok))
+        ok = compile(ctx, ptr, len, true);
+    unit_set_arena(unit);
+    return ok;
+}
+
+const char *tiger_output(tiger_ctx_t ctx, size_t *len)
+{
+    *len = ctx->out_len;
+    return ctx->out;
+}
+
+const tiger_diag_t *tiger_diagnostics(tiger_ctx_t ctx, int *count)
+{
+    *count = ctx->diag_count;
+    return ctx->diags;
+}
+
+list_t tiger_string_frags(tiger_ctx_t ctx)
+{
+    return ctx->string_frags;
+}
+
+list_t tiger_proc_frags(tiger_ctx_t ctx)
+{
+    return ctx->proc_frags;
+}
@@ -0,0 +1,41 @@
+#ifndef INCLUDE__TIGER_H
+#define INCLUDE__TIGER_H
+
+#include <stddef.h>
+
+#include "utils.h"
+
+/* Compile Tiger source held in memory.  A context keeps the results of its
+ * last compilation until the next one or until it is freed; it must be used
+ * by one thread at a time, but separate contexts may run on separate
+ * threads.  The fragments name their labels by symbols, which only last
+ * until the next compilation on the same thread. */
+typedef struct tiger_ctx_s *tiger_ctx_t;
+
+typedef struct tiger_diag_s tiger_diag_t;
+struct tiger_diag_s
+{
+    int line;
+    int column;
+    string_t message;
+};
+
+tiger_ctx_t tiger_ctx_new(void);
+void tiger_ctx_free(tiger_ctx_t ctx);
+
+/* False if any error was reported. */
+bool tiger_compile_buffer(tiger_ctx_t ctx, const char *ptr, size_t len);
+/* Only type-check; the results have diagnostics but no output or
+ * fragments.  When the source differs from that of the context's last
+ * check only within one function body, only that body is parsed again,
+ * and only it and the bodies around it are checked again. */
+bool tiger_check_buffer(tiger_ctx_t ctx, const char *ptr, size_t len);
+
+/* The fragments as the tiger program prints them. */
+const char *tiger_output(tiger_ctx_t ctx, size_t *len);
+const tiger_diag_t *tiger_diagnostics(tiger_ctx_t ctx, int *count);
+/* Lists of fr_frag_t. */
+list_t tiger_string_frags(tiger_ctx_t ctx);
+list_t tiger_proc_frags(tiger_ctx_t ctx);
+
+#endif
@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <stdlib.h>
 
 #include "frame.h"
 #include "ir.h"
@@ -13,21 +14,40 @@ struct tr_access_s
 
 static tr_access_t tr_access(tr_level_t level, fr_access_t access)
 {
-    tr_access_t p = checked_malloc(sizeof(*p));
+    tr_access_t p = unit_alloc(sizeof(*p));
     p->level = level;
     p->access = access;
     return p;
 }
 
+/* In display mode display[d] holds the frame pointer of the enclosing
+ * level at depth d while the level's body is translated, or 0 until a use
+ * asks for it; the entry code loads them. */
 struct tr_level_s
 {
     tr_level_t parent;
+    int depth;
     frame_t frame;
+    tr_access_t static_link;
     list_t formals;
-    list_t locals;
+    list_queue_t locals;
+    temp_t *display;
 };
 
-static tr_level_t _outermost = NULL;
+bool tr_display = false;
+
+static THREAD_LOCAL tr_level_t _outermost = NULL;
+
+/* The outermost level outlives the unit, since the base environment's
+ * functions belong to it, but its locals do not. */
+void tr_reset(void)
+{
+    if (_outermost)
+    {
+        _outermost->locals.head = _outermost->locals.tail = NULL;
+        fr_clear_locals(_outermost->frame);
+    }
+}
 
 tr_level_t tr_outermost(void)
 {
@@ -36,15 +56,30 @@ tr_level_t tr_outermost(void)
     return _outermost;
 }
 
-tr_level_t tr_level(tr_level_t parent, tmp_label_t name, list_t formals)
+/* A nested level's first formal is its static link, which always escapes;
+ * tr_formals leaves it out. */
+static tr_level_t new_level(tr_level_t parent,
+                            bool static_link,
+                            tmp_label_t name,
+                            list_t formals)
 {
-    tr_level_t p = checked_malloc(sizeof(*p));
+    tr_level_t p = unit_alloc(sizeof(*p));
     list_t fr_formal, q = NULL;
 
     p->parent = parent;
-    /* extra formal for static link */
-    p->frame = frame(name, bool_list(true, formals));
+    p->depth = parent ? parent->depth + 1 : 0;
+    p->display = NULL;
+    p->static_link = NULL;
+    p->formals = NULL;
+    if (static_link)
+        formals = bool_list(true, formals);
+    p->frame = frame(name, formals);
     fr_formal = fr_formals(p->frame);
+    if (static_link)
+    {
+        p->static_link = tr_access(p, fr_formal->data);
+        fr_formal = fr_formal->next;
+    }
     for (; fr_formal; fr_formal = fr_formal->next)
     {
         tr_access_t access = tr_access(p, fr_formal->data);
@@ -56,10 +91,20 @@ tr_level_t tr_level(tr_level_t parent, tmp_label_t name, list_t formals)
         else
             p->formals = q = list(access, NULL);
     }
-    p->locals = NULL;
+    p->locals.head = p->locals.tail = NULL;
     return p;
 }
 
+tr_level_t tr_level(tr_level_t parent, tmp_label_t name, list_t formals)
+{
+    return new_level(parent, parent != NULL, name, formals);
+}
+
+tr_level_t tr_lifted_level(tmp_label_t name, list_t formals)
+{
+    return new_level(NULL, false, name, formals);
+}
+
 list_t tr_formals(tr_level_t level)
 {
     return level->formals;
@@ -70,15 +115,7 @@ tr_access_t tr_alloc_local(tr_level_t level, bool escape)
     fr_access_t fr_access = fr_alloc_local(level->frame, escape);
     tr_access_t access = tr_access(level, fr_access);
 
-    if (level->locals)
-    {
-        list_t p = level->locals;
-        while (p->next)
-            p = p->next;
-        p->next = list(access, NULL);
-    }
-    else
-        level->locals = list(access, NULL);
+    list_enqueue(&level->locals, list(access, NULL));
     return access;
 }
 
@@ -89,8 +126,40 @@ frame_t tr_level_frame(tr_level_t level)
 
 static tr_access_t tr_static_link(tr_level_t level)
 {
-    assert(level);
-    return level->formals->data;
+    assert(level && level->static_link);
+    return level->static_link;
+}
+
+/* The frame pointer of target, an enclosing level of level or level
+ * itself, as code in level's body reaches it: up the static links, or in
+ * display mode from the temp the entry code loads it into. */
+static ir_expr_t tr_frame_ptr(tr_level_t level, tr_level_t target)
+{
+    ir_expr_t fp = ir_tmp_expr(fr_fp());
+
+    if (level == target)
+        return fp;
+    if (tr_display)
+    {
+        int i;
+
+        if (!level->display)
+        {
+            level->display = checked_malloc(
+                level->depth * sizeof(*level->display));
+            for (i = 0; i < level->depth; i++)
+                level->display[i] = 0;
+        }
+        if (!level->display[target->depth])
+            level->display[target->depth] = temp();
+        return ir_tmp_expr(level->display[target->depth]);
+    }
+    for (; level != target; level = level->parent)
+    {
+        assert(level->parent);
+        fp = fr_expr(tr_static_link(level)->access, fp);
+    }
+    return fp;
 }
 
 typedef struct cx_s cx_t;
@@ -114,7 +183,7 @@ struct tr_expr_s
 
 static tr_expr_t tr_ex(ir_expr_t expr)
 {
-    tr_expr_t p = checked_malloc(sizeof(*p));
+    tr_expr_t p = unit_alloc(sizeof(*p));
     p->kind = TR_EX;
     p->u.ex = expr;
     return p;
@@ -122,7 +191,7 @@ static tr_expr_t tr_ex(ir_expr_t expr)
 
 static tr_expr_t tr_nx(ir_stmt_t stmt)
 {
-    tr_expr_t p = checked_malloc(sizeof(*p));
+    tr_expr_t p = unit_alloc(sizeof(*p));
     p->kind = TR_NX;
     p->u.nx = stmt;
     return p;
@@ -130,7 +199,7 @@ static tr_expr_t tr_nx(ir_stmt_t stmt)
 
 static tr_expr_t tr_cx(list_t trues, list_t falses, ir_stmt_t stmt)
 {
-    tr_expr_t p = checked_malloc(sizeof(*p));
+    tr_expr_t p = unit_alloc(sizeof(*p));
     p->kind = TR_CX;
     p->u.cx.trues = trues;
     p->u.cx.falses = falses;
@@ -205,8 +274,22 @@ static cx_t un_cx(tr_expr_t expr)
     switch (expr->kind)
     {
         case TR_EX:
+            /* A constant condition jumps straight to the one side taken. */
+            if (expr->u.ex->kind == IR_CONST)
+            {
+                list_t patch;
+
+                cx.stmt = ir_jump_stmt(ir_name_expr(NULL), list(NULL, NULL));
+                patch = list(&cx.stmt->u.jump.expr->u.name,
+                             list(&cx.stmt->u.jump.jumps->data, NULL));
+                if (expr->u.ex->u.const_)
+                    cx.trues = patch;
+                else
+                    cx.falses = patch;
+                return cx;
+            }
             cx.stmt = ir_cjump_stmt(
-              IR_EQ, expr->u.ex, ir_const_expr(0), NULL, NULL);
+              IR_NE, expr->u.ex, ir_const_expr(0), NULL, NULL);
             cx.trues = list(&(cx.stmt->u.cjump.t), NULL);
             cx.falses = list(&(cx.stmt->u.cjump.f), NULL);
             return cx;
@@ -235,16 +318,22 @@ tr_expr_t tr_string_expr(string_t str)
     return tr_ex(ir_name_expr(label));
 }
 
-tr_expr_t tr_call_expr(tr_level_t level, tmp_label_t label, list_t args)
+tr_expr_t tr_call_expr(tr_level_t level,
+                       tr_level_t callee,
+                       tmp_label_t label,
+                       list_t args)
 {
     ir_expr_t func = ir_name_expr(label);
-    ir_expr_t fp = ir_const_expr(fr_offset(
-        tr_static_link(level)->access));
-    list_t l_args = list(fp, NULL);
-    list_t l_next = l_args;
+    list_queue_t l_args = { NULL, NULL };
+
+    /* The library's functions, which belong to the outermost level
+     * itself, and lifted ones take no static link. */
+    if (callee->static_link)
+        list_enqueue(&l_args,
+                     list(tr_frame_ptr(level, callee->parent), NULL));
     for (; args; args = args->next)
-        l_next = l_next->next = list(un_ex(args->data), NULL);
-    return tr_ex(ir_call_expr(func, l_args));
+        list_enqueue(&l_args, list(un_ex(args->data), NULL));
+    return tr_ex(ir_call_expr(func, l_args.head));
 }
 
 tr_expr_t tr_op_expr(int op, tr_expr_t left, tr_expr_t right)
@@ -256,7 +345,14 @@ tr_expr_t tr_op_expr(int op, tr_expr_t left, tr_expr_t right)
 
 tr_expr_t tr_rel_expr(int op, tr_expr_t left, tr_expr_t right)
 {
-    ir_stmt_t stmt = ir_cjump_stmt(op, un_ex(left), un_ex(right), NULL, NULL);
+    ir_expr_t l = un_ex(left);
+    ir_expr_t r = un_ex(right);
+    ir_stmt_t stmt;
+
+    if (l->kind == IR_CONST && r->kind == IR_CONST)
+        return tr_ex(ir_const_expr(ir_compare(op, l->u.const_,
+                                              r->u.const_)));
+    stmt = ir_cjump_stmt(op, l, r, NULL, NULL);
     return tr_cx(list(&stmt->u.cjump.t, NULL),
                  list(&stmt->u.cjump.f, NULL),
                  stmt);
@@ -264,8 +360,8 @@ tr_expr_t tr_rel_expr(int op, tr_expr_t left, tr_expr_t right)
 
 tr_expr_t tr_string_rel_expr(int op, tr_expr_t left, tr_expr_t right)
 {
-    ir_expr_t expr = fr_external_call("_CompareString",
-                                      list(left, list(right, NULL)));
+    list_t args = list(un_ex(left), list(un_ex(right), NULL));
+    ir_expr_t expr = fr_external_call("_CompareString", args);
     ir_stmt_t stmt = ir_cjump_stmt(op, expr, ir_const_expr(0), NULL, NULL);
     return tr_cx(list(&stmt->u.cjump.t, NULL),
                  list(&stmt->u.cjump.f, NULL),
@@ -404,36 +500,64 @@ tr_expr_t tr_assign_expr(tr_expr_t lhs, tr_expr_t rhs)
 
 tr_expr_t tr_simple_var(tr_access_t access, tr_level_t level)
 {
-    ir_expr_t fp = ir_tmp_expr(fr_fp());
+    ir_expr_t fp = NULL;
 
+    /* A register needs no frame pointer, and in display mode asking for
+     * one would have the entry code load a display entry for nothing. */
+    if (fr_in_frame(access->access))
+        fp = tr_frame_ptr(level, access->level);
     return tr_ex(fr_expr(access->access, fp));
+}
+
+tr_expr_t tr_field_var(tr_expr_t record, int index)
+{
+    return tr_ex(ir_mem_expr(ir_binop_expr(
+          IR_PLUS, un_ex(record), ir_const_expr(index * FR_WORD_SIZE))));
+}
+
+/* The display is loaded nearest level first, each frame pointer from the
+ * static link in the frame of the level inside it, out to the outermost
+ * level used. */
+static ir_stmt_t load_display(tr_level_t level, ir_stmt_t body)
+{
+    list_queue_t stmts = { NULL, NULL };
+    ir_expr_t fp = ir_tmp_expr(fr_fp());
+    tr_level_t p;
+    int outer = level->depth, i;
 
-#if 0
-    while (level != access->level)
+    for (i = 0; i < level->depth; i++)
+        if (level->display[i])
+        {
+            outer = i;
+            break;
+        }
+    for (p = level; p->depth > outer; p = p->parent)
     {
-        fr_access_t fr_access = tr_static_link(level)->access;
-        fp = ir_mem_expr(ir_binop_expr(
-            IR_PLUS, fp,
-            ir_const_expr(fr_offset(fr_access))));
-        level = level->parent;
+        temp_t *tmp = &level->display[p->parent->depth];
+
+        if (!*tmp)
+            *tmp = temp();
+        list_enqueue(&stmts, list(ir_move_stmt(
+            ir_tmp_expr(*tmp),
+            fr_expr(tr_static_link(p)->access, fp)), NULL));
+        fp = ir_tmp_expr(*tmp);
     }
-    return tr_ex(ir_mem_expr(ir_binop_expr(
-          IR_PLUS, fp,
-          ir_const_expr(fr_offset(access->access)))));
-#endif
+    list_enqueue(&stmts, list(body, NULL));
+    free(level->display);
+    level->display = NULL;
+    return ir_seq_stmt(stmts.head);
 }
 
-tr_expr_t tr_field_var(tr_expr_t record, int index)
+void tr_proc_entry_exit(tr_level_t level, tr_expr_t body)
 {
-    return tr_ex(ir_mem_expr(ir_binop_expr(
-          IR_PLUS,
-          un_ex(record),
-          ir_binop_expr(IR_MUL,
-                        ir_const_expr(index),
-                        ir_const_expr(FR_WORD_SIZE)))));
+    ir_stmt_t stmt = ir_move_stmt(ir_tmp_expr(fr_rv()), un_ex(body));
+
+    if (level->display)
+        stmt = load_display(level, stmt);
+    fr_add_frag(fr_proc_frag(stmt, level->frame));
 }
 
-void tr_pp_expr(tr_expr_t expr)
+void tr_pp_expr(FILE *out, tr_expr_t expr)
 {
-    pp_stmts(stdout, list(un_nx(expr), NULL));
+    pp_stmts(out, list(un_nx(expr), NULL));
 }
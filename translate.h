@@ -9,8 +9,17 @@
 typedef struct tr_access_s *tr_access_t;
 typedef struct tr_level_s *tr_level_t;
 
+/* Keep the frame pointers of the enclosing functions a body uses in temps
+ * loaded once on entry, instead of following the static links at each
+ * use; off by default. */
+extern bool tr_display;
+
+void tr_reset(void);
 tr_level_t tr_outermost(void);
 tr_level_t tr_level(tr_level_t parent, tmp_label_t name, list_t formals);
+/* A level for a lifted function: at the top, like the outermost, and with
+ * no static link. */
+tr_level_t tr_lifted_level(tmp_label_t name, list_t formals);
 list_t tr_formals(tr_level_t level);
 tr_access_t tr_alloc_local(tr_level_t level, bool escape);
 frame_t tr_level_frame(tr_level_t level);
@@ -19,7 +28,11 @@ typedef struct tr_expr_s *tr_expr_t;
 
 tr_expr_t tr_num_expr(int num);
 tr_expr_t tr_string_expr(string_t str);
-tr_expr_t tr_call_expr(tr_level_t level, tmp_label_t label, list_t args);
+/* level is the caller's, callee the level of the function called. */
+tr_expr_t tr_call_expr(tr_level_t level,
+                       tr_level_t callee,
+                       tmp_label_t label,
+                       list_t args);
 tr_expr_t tr_op_expr(int op, tr_expr_t left, tr_expr_t right);
 tr_expr_t tr_rel_expr(int op, tr_expr_t left, tr_expr_t right);
 tr_expr_t tr_string_rel_expr(int op, tr_expr_t left, tr_expr_t right);
@@ -37,6 +50,9 @@ tr_expr_t tr_assign_expr(tr_expr_t lhs, tr_expr_t rhs);
 tr_expr_t tr_simple_var(tr_access_t access, tr_level_t level);
 tr_expr_t tr_field_var(tr_expr_t record, int index);
 
-void tr_pp_expr(tr_expr_t expr);
+/* Record a function's body as a fragment, returning its value in RV. */
+void tr_proc_entry_exit(tr_level_t level, tr_expr_t body);
+
+void tr_pp_expr(FILE *out, tr_expr_t expr);
 
 #endif
@@ -28,17 +28,61 @@ type_t ty_void(void)
     return &_ty_void;
 }
 
+/* A record indexes its fields in an open-addressed table at least twice
+ * their number, so finding a field by name takes a probe or two however
+ * many fields the record has.  Each field knows its offset; a name given
+ * twice finds the first field of that name. */
 type_t ty_record(list_t fields)
 {
-    type_t p = checked_malloc(sizeof(*p));
+    type_t p = unit_alloc(sizeof(*p));
+    ty_field_t *index;
+    list_t q;
+    int count = 0, size = 1, i;
+
+    for (q = fields; q; q = q->next)
+        count++;
+    while (size < 2 * count)
+        size *= 2;
+
+    index = unit_alloc(size * sizeof(*index));
+    for (i = 0; i < size; i++)
+        index[i] = NULL;
+    for (q = fields, i = 0; q; q = q->next, i++)
+    {
+        ty_field_t field = q->data;
+        int j = ptr_hash(field->name) & (size - 1);
+
+        field->offset = i;
+        while (index[j] && index[j]->name != field->name)
+            j = (j + 1) & (size - 1);
+        if (!index[j])
+            index[j] = field;
+    }
+
     p->kind = TY_RECORD;
-    p->u.record = fields;
+    p->u.record.fields = fields;
+    p->u.record.index = index;
+    p->u.record.mask = size - 1;
     return p;
 }
 
+ty_field_t ty_lookup_field(type_t record, symbol_t name)
+{
+    ty_field_t *index = record->u.record.index;
+    int j;
+
+    assert(record->kind == TY_RECORD);
+    for (j = ptr_hash(name) & record->u.record.mask;
+         index[j];
+         j = (j + 1) & record->u.record.mask)
+        if (index[j]->name == name)
+            return index[j];
+    return NULL;
+}
+
 type_t ty_array(type_t type)
 {
-    type_t p = checked_malloc(sizeof(*p));
+    type_t p = unit_alloc(sizeof(*p));
     p->kind = TY_ARRAY;
     p->u.array = type;
     return p;
@@ -46,7 +90,7 @@ type_t ty_array(type_t type)
 
 type_t ty_name(symbol_t name, type_t type)
 {
-    type_t p = checked_malloc(sizeof(*p));
+    type_t p = unit_alloc(sizeof(*p));
     p->kind = TY_NAME;
     p->u.name.name = name;
     p->u.name.type = type;
@@ -55,23 +99,41 @@ type_t ty_name(symbol_t name, type_t type)
 
 ty_field_t ty_field(symbol_t name, type_t type)
 {
-    ty_field_t p = checked_malloc(sizeof(*p));
+    ty_field_t p = unit_alloc(sizeof(*p));
     p->name = name;
     p->type = type;
+    p->offset = 0;
     return p;
 }
 
+/* Once its declaration group has been resolved, a name points straight at
+ * the type it stands for, or at nothing if it is part of a cycle, in which
+ * case the name stands for itself. */
 type_t ty_actual(type_t type)
 {
-    type_t origin = type;
-    int counter = 0;
-
     assert(type);
-    while (type->kind == TY_NAME)
-    {
+    if (type->kind == TY_NAME && type->u.name.type)
+        return type->u.name.type;
+    return type;
+}
+
+type_t ty_resolve(type_t name, int limit)
+{
+    type_t type = name->u.name.type, p;
+
+    assert(name->kind == TY_NAME);
+    while (type && type->kind == TY_NAME && limit-- > 0)
         type = type->u.name.type;
-        if (++counter > 4096)
-            return origin;
+    if (type && type->kind == TY_NAME)
+        type = NULL;
+
+    /* Point the whole chain at the result, so that later walks through
+     * any of its names take a single step. */
+    for (p = name; p && p->kind == TY_NAME && p->u.name.type != type; )
+    {
+        type_t next = p->u.name.type;
+        p->u.name.type = type;
+        p = next;
     }
     return type;
 }
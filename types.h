@@ -11,7 +11,7 @@ struct type_s
     enum { TY_RECORD, TY_NIL, TY_INT, TY_STRING, TY_ARRAY, TY_NAME, TY_VOID } kind;
     union
     {
-        list_t record;
+        struct { list_t fields; ty_field_t *index; int mask; } record;
         type_t array;
         struct { symbol_t name; type_t type; } name;
     } u;
@@ -28,10 +28,16 @@ struct ty_field_s
 {
     symbol_t name;
     type_t type;
+    int offset;
 };
 ty_field_t ty_field(symbol_t name, type_t type);
+ty_field_t ty_lookup_field(type_t record, symbol_t name);
 
 type_t ty_actual(type_t type);
+/* Point the name, and every name its chain runs through, at the type at
+ * the end of the chain.  A chain longer than limit names is taken to be a
+ * cycle: its names are left without a type and NULL is returned. */
+type_t ty_resolve(type_t name, int limit);
 bool ty_match(type_t type1, type_t type2);
 
 void ty_print(type_t type);
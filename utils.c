@@ -1,4 +1,6 @@
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -18,9 +20,338 @@ void *checked_malloc(int size)
     return p;
 }
 
+void *grow_array(void *array, int count, int *cap, int size)
+{
+    char *p;
+
+    *cap = *cap ? *cap * 2 : 64;
+    p = checked_malloc(*cap * size);
+    if (array)
+    {
+        memcpy(p, array, count * size);
+        free(array);
+    }
+    return p;
+}
+
+unsigned int ptr_hash(const void *ptr)
+{
+    uintptr_t h = (uintptr_t) ptr;
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+    return (unsigned int) h;
+}
+
+/* Bump-pointer allocation out of large chunks; everything allocated from an
+ * arena is released together by arena_free() or arena_reset(). */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGN 8
+
+typedef struct arena_chunk_s *arena_chunk_t;
+struct arena_chunk_s
+{
+    arena_chunk_t next;
+};
+
+struct arena_s
+{
+    arena_chunk_t chunks;
+    char *next;
+    char *limit;
+};
+
+arena_t arena_new(void)
+{
+    arena_t p = checked_malloc(sizeof(*p));
+    p->chunks = NULL;
+    p->next = p->limit = NULL;
+    return p;
+}
+
+#define ARENA_HEADER \
+    ((int) (sizeof(struct arena_chunk_s) + ARENA_ALIGN - 1) \
+     & ~(ARENA_ALIGN - 1))
+
+static char *arena_grow(arena_t arena, int size)
+{
+    int len = size > ARENA_CHUNK_SIZE - ARENA_HEADER
+            ? size + ARENA_HEADER : ARENA_CHUNK_SIZE;
+    arena_chunk_t chunk = checked_malloc(len);
+    char *p = (char *) chunk + ARENA_HEADER;
+
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    /* Oversized requests get a chunk of their own and leave the current
+     * chunk in place for the small ones that follow. */
+    if (len == ARENA_CHUNK_SIZE)
+    {
+        arena->next = p + size;
+        arena->limit = (char *) chunk + len;
+    }
+    return p;
+}
+
+void *arena_alloc(arena_t arena, int size)
+{
+    char *p;
+
+    assert(arena && size >= 0);
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if (arena->limit - arena->next < size)
+        return arena_grow(arena, size);
+    p = arena->next;
+    arena->next += size;
+    return p;
+}
+
+string_t arena_string(arena_t arena, const char *str, int len)
+{
+    string_t p = arena_alloc(arena, len + 1);
+    memcpy(p, str, len);
+    p[len] = 0;
+    return p;
+}
+
+/* Release everything but the chunk being filled, which is rewound for
+ * the next round of allocations. */
+void arena_reset(arena_t arena)
+{
+    arena_chunk_t chunk = arena->chunks, keep = NULL;
+
+    while (chunk)
+    {
+        arena_chunk_t next = chunk->next;
+        if (arena->limit == (char *) chunk + ARENA_CHUNK_SIZE)
+            keep = chunk;
+        else
+            free(chunk);
+        chunk = next;
+    }
+    arena->chunks = keep;
+    if (keep)
+    {
+        keep->next = NULL;
+        arena->next = (char *) keep + ARENA_HEADER;
+    }
+    else
+        arena->next = arena->limit = NULL;
+}
+
+void arena_free(arena_t arena)
+{
+    arena_chunk_t chunk = arena->chunks;
+
+    while (chunk)
+    {
+        arena_chunk_t next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
+
+void arena_adopt(arena_t arena, arena_t from)
+{
+    arena_chunk_t chunk = from->chunks;
+
+    if (chunk)
+    {
+        while (chunk->next)
+            chunk = chunk->next;
+        chunk->next = arena->chunks;
+        arena->chunks = from->chunks;
+    }
+    free(from);
+}
+
+static THREAD_LOCAL arena_t _unit_arena = NULL;
+
+arena_t unit_set_arena(arena_t arena)
+{
+    arena_t old = _unit_arena;
+    _unit_arena = arena;
+    return old;
+}
+
+arena_t unit_arena(void)
+{
+    return _unit_arena;
+}
+
+void *unit_alloc(int size)
+{
+    if (_unit_arena)
+        return arena_alloc(_unit_arena, size);
+    return checked_malloc(size);
+}
+
+#define SLAB_SIZE (16 * 1024)
+#define SLAB_CLASSES 8
+
+typedef struct slab_cell_s *slab_cell_t;
+struct slab_cell_s
+{
+    slab_cell_t next;
+};
+
+static THREAD_LOCAL slab_cell_t _slab_free[SLAB_CLASSES];
+static THREAD_LOCAL char *_slab_next[SLAB_CLASSES];
+static THREAD_LOCAL char *_slab_limit[SLAB_CLASSES];
+
+#ifdef ALLOC_STATS
+static THREAD_LOCAL int _alloc_counts[ALLOC_KINDS];
+static THREAD_LOCAL int _slab_count;
+
+void alloc_reset_counts(void)
+{
+    int i;
+
+    for (i = 0; i < ALLOC_KINDS; i++)
+        _alloc_counts[i] = 0;
+    _slab_count = 0;
+}
+
+void alloc_report(FILE *out)
+{
+    fprintf(out, "allocs     list %d, binder %d, ir_stmt %d, ir_expr %d, "
+            "in %d new slabs\n",
+            _alloc_counts[ALLOC_LIST], _alloc_counts[ALLOC_BINDER],
+            _alloc_counts[ALLOC_IR_STMT], _alloc_counts[ALLOC_IR_EXPR],
+            _slab_count);
+}
+#endif
+
+/* Size classes are multiples of ARENA_ALIGN; anything bigger than the
+ * largest class goes straight to malloc. */
+static int slab_class(int size)
+{
+    return (size + ARENA_ALIGN - 1) / ARENA_ALIGN - 1;
+}
+
+void *slab_alloc(alloc_kind_t kind, int size)
+{
+    int c = slab_class(size);
+    char *p;
+
+#ifdef ALLOC_STATS
+    _alloc_counts[kind]++;
+#endif
+    if (_unit_arena && kind != ALLOC_BINDER)
+        return arena_alloc(_unit_arena, size);
+    if (c >= SLAB_CLASSES)
+        return checked_malloc(size);
+    if (_slab_free[c])
+    {
+        slab_cell_t cell = _slab_free[c];
+        _slab_free[c] = cell->next;
+        return cell;
+    }
+    size = (c + 1) * ARENA_ALIGN;
+    if (_slab_limit[c] - _slab_next[c] < size)
+    {
+        _slab_next[c] = checked_malloc(SLAB_SIZE);
+        _slab_limit[c] = _slab_next[c] + SLAB_SIZE;
+#ifdef ALLOC_STATS
+        _slab_count++;
+#endif
+    }
+    p = _slab_next[c];
+    _slab_next[c] += size;
+    return p;
+}
+
+void slab_free(void *p, int size)
+{
+    int c = slab_class(size);
+    slab_cell_t cell = p;
+
+    if (c >= SLAB_CLASSES)
+    {
+        free(p);
+        return;
+    }
+    cell->next = _slab_free[c];
+    _slab_free[c] = cell;
+}
+
+struct pool_s
+{
+    pthread_mutex_t run_lock;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    void (*run)(void *data, int task);
+    void *data;
+    int tasks;
+    int next;
+    int finished;
+};
+
+static void *pool_thread(void *arg)
+{
+    pool_t pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;)
+    {
+        int task;
+
+        while (pool->next >= pool->tasks)
+            pthread_cond_wait(&pool->work, &pool->lock);
+        task = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        pool->run(pool->data, task);
+        pthread_mutex_lock(&pool->lock);
+        if (++pool->finished == pool->tasks)
+            pthread_cond_signal(&pool->done);
+    }
+    return NULL;
+}
+
+pool_t pool_new(int threads)
+{
+    pool_t p = checked_malloc(sizeof(*p));
+    int i;
+
+    pthread_mutex_init(&p->run_lock, NULL);
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->done, NULL);
+    p->tasks = p->next = p->finished = 0;
+    for (i = 0; i < threads; i++)
+    {
+        pthread_t thread;
+
+        if (pthread_create(&thread, NULL, pool_thread, p) != 0)
+        {
+            fprintf(stderr, "cannot create thread\n");
+            exit(1);
+        }
+        pthread_detach(thread);
+    }
+    return p;
+}
+
+void pool_run(pool_t pool, int tasks, void (*run)(void *data, int task),
+              void *data)
+{
+    pthread_mutex_lock(&pool->run_lock);
+    pthread_mutex_lock(&pool->lock);
+    pool->run = run;
+    pool->data = data;
+    pool->tasks = tasks;
+    pool->next = pool->finished = 0;
+    pthread_cond_broadcast(&pool->work);
+    while (pool->finished < tasks)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_unlock(&pool->run_lock);
+}
+
 list_t list(void *data, list_t next)
 {
-    list_t p = checked_malloc(sizeof(*p));
+    list_t p = slab_alloc(ALLOC_LIST, sizeof(*p));
     p->data = data;
     p->next = next;
     return p;
@@ -46,7 +377,7 @@ list_t vlist(int count, ...)
 
 list_t int_list(int i, list_t next)
 {
-    list_t p = checked_malloc(sizeof(*p));
+    list_t p = slab_alloc(ALLOC_LIST, sizeof(*p));
     p->i = i;
     p->next = next;
     return p;
@@ -54,7 +385,7 @@ list_t int_list(int i, list_t next)
 
 list_t bool_list(bool b, list_t next)
 {
-    list_t p = checked_malloc(sizeof(*p));
+    list_t p = slab_alloc(ALLOC_LIST, sizeof(*p));
     p->b = b;
     p->next = next;
     return p;
@@ -75,3 +406,12 @@ list_t list_append(list_t list1, void *data)
 {
     return join_list(list1, list(data, NULL));
 }
+
+void list_enqueue(list_queue_t *queue, list_t cell)
+{
+    assert(cell && !cell->next);
+    if (queue->tail)
+        queue->tail = queue->tail->next = cell;
+    else
+        queue->head = queue->tail = cell;
+}
@@ -2,17 +2,73 @@
 #define INCLUDE__UTILS_H
 
 #include <assert.h>
+#include <stdio.h>
 
 typedef char *string_t;
 string_t string(const char *);
 
+/* Compiler state lives in per-thread globals so that several units can be
+ * compiled at once, one per thread. */
+#define THREAD_LOCAL _Thread_local
+
 typedef char bool;
 #define true 1
 #define false 0
 
-#define HT_SIZE 773
-
 void *checked_malloc(int);
+/* Double the capacity of an array holding count elements of size bytes,
+ * or make room for 64 if it has none, and return the new array. */
+void *grow_array(void *array, int count, int *cap, int size);
+/* Pointers' low bits are mostly alignment; mix them all into the bits
+ * that select a bucket. */
+unsigned int ptr_hash(const void *ptr);
+
+typedef struct arena_s *arena_t;
+arena_t arena_new(void);
+void *arena_alloc(arena_t arena, int size);
+string_t arena_string(arena_t arena, const char *str, int len);
+void arena_reset(arena_t arena);
+void arena_free(arena_t arena);
+/* Move everything allocated from from into arena, and free from. */
+void arena_adopt(arena_t arena, arena_t from);
+
+/* While a unit is compiled, what lives no longer than the unit -- its IR,
+ * lists, types, frames and the translator's records -- comes from the
+ * unit's arena and is released with it.  Without one, as while the base
+ * environment is built, the same allocations are made for good.  Setting
+ * the thread's unit arena returns the one it replaces. */
+arena_t unit_set_arena(arena_t arena);
+arena_t unit_arena(void);
+void *unit_alloc(int size);
+
+/* Small fixed-size nodes come from per-thread slabs, one for each size
+ * class, and go back to their class's free list.  Those of a unit come
+ * from its arena instead, all but binders, which are freed one by one. */
+typedef enum
+{
+    ALLOC_LIST,
+    ALLOC_BINDER,
+    ALLOC_IR_STMT,
+    ALLOC_IR_EXPR,
+    ALLOC_KINDS,
+} alloc_kind_t;
+void *slab_alloc(alloc_kind_t kind, int size);
+void slab_free(void *p, int size);
+#ifdef ALLOC_STATS
+/* Count this thread's slab allocations by kind. */
+void alloc_reset_counts(void);
+void alloc_report(FILE *out);
+#endif
+
+/* Threads that run batches of tasks for any thread of the program.
+ * pool_run calls run(data, i) once for each task i, on whichever thread
+ * of the pool is free, and returns when all have returned; batches from
+ * different threads run one after another.  The threads live as long as
+ * the program, and so does their per-thread state. */
+typedef struct pool_s *pool_t;
+pool_t pool_new(int threads);
+void pool_run(pool_t pool, int tasks, void (*run)(void *data, int task),
+              void *data);
 
 typedef struct list_s *list_t;
 struct list_s
@@ -32,4 +88,15 @@ list_t bool_list(bool b, list_t next);
 list_t join_list(list_t list1, list_t list2);
 list_t list_append(list_t list1, void *data);
 
+/* A list under construction together with its last cell, so that cells
+ * are appended in constant time.  Both are NULL while it is empty. */
+typedef struct list_queue_s list_queue_t;
+struct list_queue_s
+{
+    list_t head;
+    list_t tail;
+};
+/* Append cell, a list of one, however it was allocated. */
+void list_enqueue(list_queue_t *queue, list_t cell);
+
 #endif